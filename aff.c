@@ -7,22 +7,32 @@
  *
  */
 
+#define _GNU_SOURCE
 #include <sys/types.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <fcntl.h>
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <net/if.h>
+#include <time.h>
+#include <errno.h>
+#include <sched.h>
 
 #include "jelopt.h"
 #include "jelist.h"
+#include "arena.h"
+#include "cpumask.h"
+#include "interrupts.h"
+#include "netlink.h"
+#include "ethaff.h"
 
 #define MAXNODE 32
-#define MAXCPU 64
 #define MAX(a,b)  ((a)>(b) ? (a) : (b))
+#define MIN(a,b)  ((a)<(b) ? (a) : (b))
 
 struct cpu {
 	int node;
@@ -36,29 +46,79 @@ struct memnode {
 };
 
 struct dev {
-	char *name, *fn, *old_affinity;
+	char *name, *fn, *old_affinity, *new_affinity;
+	int ifindex;
 	int numa_node;
+	int speed; /* Mb/s, -1 if unknown */
+	char *group; /* bond or team master, NULL if none */
+	int down; /* operstate down */
+	int irq; /* -1 for multiqueue devices */
+	char *effective; /* effective_affinity, NULL if not exposed */
+	int managed; /* kernel managed irq, smp_affinity is not writable */
+	int reserved; /* placed by --reserve-queues */
+	double weight; /* from --profile */
+	const char *reason; /* who pre-assigned assigned_cpu */
+	char *driver; /* "" if not known */
 	int single, rr_multi, use_rps, use_xps;
+	int pair_tx; /* tx-N goes with rx-N */
 	int xps, rps, rx, tx, txrx;
 	int assigned_cpu;
 	struct jlhead *rxq, *txq, *txrxq, *rpsq, *xpsq; // list of struct queue
 };
 
 struct queue {
-	char *name, *fn, *old_affinity;
+	char *name, *fn, *old_affinity, *new_affinity;
 	int assigned_cpu;
 	int n;
+	int irq; /* -1 for rps and xps queues */
+	char *effective; /* effective_affinity, NULL if not exposed */
+	int managed; /* kernel managed irq, smp_affinity is not writable */
+	int reserved; /* placed by --reserve-queues */
+	double weight; /* from --profile */
+	const char *reason; /* who pre-assigned assigned_cpu */
+	int napi_id; /* NAPI instance of an rx queue, 0 if not known */
+};
+
+enum { APPLY_NONE, APPLY_OK, APPLY_FAILED, APPLY_MANAGED, APPLY_MISMATCH };
+
+struct plan {
+	const char *type; /* irq, rps or xps */
+	const char *reason;
+	struct dev *dev;
+	struct queue *q; /* NULL for the irq of a single queue device */
+	char *fn, *mask;
+	int result; /* APPLY_*, set by plan_apply() and plan_verify() */
+};
+
+/*
+ * Placement strategies. A strategy may pre-assign CPUs before planning;
+ * aff_multiq() and aff_singleq() keep any assigned_cpu >= 0 and fall back
+ * to round-robin for the rest.
+ */
+struct strategy {
+	const char *name;
+	int (*preassign)(struct jlhead *devices);
 };
 
 struct {
-	char *procirq, *sysdir;
+	char *procirq, *sysdir, *procdir;
+	char *promfile, *mapfile;
 	int quiet, silent, dryrun, verbose, list, heuristics, reset;
 	int maxcpu, reservedcpus;
 	int maxq;
-	int debug;
+	int debug, timing, report, json, diff, verify;
+	int measure; /* seconds */
+	char *recordfile, *profilefile, *strategy;
 	struct jlhead *limit, *exclude; /* list of char * */
+	struct jlhead *reservations; /* list of struct reservation * */
 	struct jlhead *devices; /* list if struct dev * */
 	int rr_single, reserve_mq, memnode_dist;
+	int partition_speed;
+	int threaded_napi, napi_sibling;
+	int watch;
+	int tx_sibling;
+	char *napi_defer, *gro_flush; /* "N" or "dev:N,..." */
+	int napi_tune;
 	int num_mq, max_rx, max_tx, max_txrx;
 	struct jlhead *memnodes;
 } conf;
@@ -72,9 +132,97 @@ struct {
 	int rps_detected;
 	int xps_detected;
 	int multinode;
+	struct arena *arena; /* all allocations of a run */
+	struct jlhead *plan; /* list of struct plan * in order of application */
+	struct msi *msi; /* sorted by irq */
+	int nmsi;
+	struct cpumask avoid; /* CPUs other irqs stay off: managed, dedicated */
+	struct cpumask dedicated; /* CPUs of --reserve-queues */
+	int nmanaged; /* managed irqs known before planning */
+	const struct strategy *strategy;
+	struct timespec phase_start;
 } var;
 
-const char *demask(const char *s);
+/*
+ * report time spent since the previous phase on stderr (--timing)
+ */
+static void phase_done(const char *phase)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if(conf.timing && phase)
+		fprintf(stderr, "timing: %s %.3f ms\n", phase,
+			(now.tv_sec - var.phase_start.tv_sec) * 1e3 +
+			(now.tv_nsec - var.phase_start.tv_nsec) / 1e6);
+	var.phase_start = now;
+}
+
+/*
+ * JSON output (--json). One object per line, written as it is produced.
+ */
+static void json_str(const char *key, const char *s)
+{
+	printf(",\"%s\":\"", key);
+	for(;s && *s;s++) {
+		if(*s == '"' || *s == '\\')
+			printf("\\%c", *s);
+		else if((unsigned char)*s < 0x20)
+			printf("\\u%04x", *s);
+		else
+			putchar(*s);
+	}
+	putchar('"');
+}
+
+static void json_dev(const struct dev *dev)
+{
+	printf("{\"type\":\"dev\"");
+	json_str("dev", dev->name);
+	printf(",\"node\":%d,\"single\":%d", dev->numa_node, dev->single);
+	if(dev->group) json_str("group", dev->group);
+	printf(",\"rx\":%d,\"tx\":%d,\"txrx\":%d,\"rps\":%d,\"xps\":%d}\n",
+	       dev->rx, dev->tx, dev->txrx, dev->rps, dev->xps);
+}
+
+/* q NULL means the irq of a single queue device. reason NULL when listing */
+static void json_queue(const char *type, const struct dev *dev,
+		       const struct queue *q, const char *reason)
+{
+	char cpus[CPULIST_SIZE], fn[256];
+	const char *oldmask, *newmask;
+
+	oldmask = q ? q->old_affinity : dev->old_affinity;
+	newmask = q ? q->new_affinity : dev->new_affinity;
+
+	printf("{\"type\":\"%s\"", type);
+	json_str("dev", dev->name);
+	json_str("name", q ? q->name : dev->name);
+	if(reason) json_str("reason", reason);
+	if(q) printf(",\"queue\":%d", q->n);
+	if((q ? q->irq : dev->irq) >= 0)
+		printf(",\"irq\":%d", q ? q->irq : dev->irq);
+	printf(",\"node\":%d", dev->numa_node);
+	if(oldmask) {
+		json_str("old", oldmask);
+		json_str("old_cpus", demask(oldmask, cpus, sizeof(cpus)));
+	}
+	if(newmask) {
+		json_str("new", newmask);
+		json_str("new_cpus", demask(newmask, cpus, sizeof(cpus)));
+	}
+	if(q ? q->effective : dev->effective)
+		json_str("effective", q ? q->effective : dev->effective);
+	if(q ? q->managed : dev->managed)
+		printf(",\"managed\":true");
+	/* irq queues keep the /proc/irq/N directory in fn */
+	if(!strcmp(type, "irq")) {
+		snprintf(fn, sizeof(fn), "%s/smp_affinity", q ? q->fn : dev->fn);
+		json_str("file", fn);
+	} else
+		json_str("file", q->fn);
+	printf("}\n");
+}
 
 /*
  * split a string into a list of strings.
@@ -89,10 +237,8 @@ static struct jlhead *jl_splitstr(struct jlhead *l, const char *s, int delim)
 		for(start=s;*s;s++)
 			if(*s == delim)
 				break;
-		path = malloc(s-start+1);
+		path = arena_strndup(var.arena, start, s-start);
 		if(!path) return l;
-		strncpy(path, start, s-start);
-		path[s-start] = 0;
 		jl_append(l, path);
 		if(*s) s++;
 	}
@@ -102,7 +248,7 @@ static struct jlhead *jl_splitstr(struct jlhead *l, const char *s, int delim)
 static struct cpu *cpu_new(int n, int cpuid, int iter)
 {
 	struct cpu *cpu;
-	cpu = malloc(sizeof(struct cpu));
+	cpu = arena_alloc(var.arena, sizeof(struct cpu));
 	if(cpu) {
 		cpu->node = n;
 		cpu->cpu = cpuid;
@@ -119,7 +265,7 @@ static struct memnode *memnode_get(int n)
 		if(node->n == n)
 			return node;
 	}
-	node = malloc(sizeof(struct memnode));
+	node = arena_alloc(var.arena, sizeof(struct memnode));
 	if(node) {
 		memset(node, 0, sizeof(struct memnode));
 		node->n = n;
@@ -244,11 +390,11 @@ static struct jlhead *memnodes_cpu_select(int nselect, int cpu_offset)
 }
 
 /* create a mask with all cpus on current node, except reserved CPUs */
-static int node_cpu_mask(unsigned long long *bitmaskp, char *buf, size_t bufsize, int cpu)
+static int node_cpu_mask(struct cpumask *maskp, char *buf, size_t bufsize, int cpu)
 {
 	/* lookup node for cpu. then add all cpus from that node */
 	struct memnode *node, *usenode = NULL;
-	unsigned long long bitmask = 0;
+	struct cpumask mask;
 	int i;
 	
 	jl_foreach(conf.memnodes, node) {
@@ -260,211 +406,207 @@ static int node_cpu_mask(unsigned long long *bitmaskp, char *buf, size_t bufsize
 	if(!usenode)
 		return -1;
 
+	cpumask_zero(&mask);
 	for(i=var.cpu_offset;i<MAXCPU;i++) {
-		if(usenode->cpu[i])
-			bitmask |= (1 << i);
+		if(usenode->cpu[i] && !cpumask_isset(&var.dedicated, i))
+			cpumask_set(&mask, i);
 	}
+	/* a node of nothing but dedicated CPUs */
+	if(!cpumask_weight(&mask))
+		for(i=var.cpu_offset;i<MAXCPU;i++)
+			if(usenode->cpu[i])
+				cpumask_set(&mask, i);
 
-	if(bitmaskp) *bitmaskp = bitmask;
-	snprintf(buf, bufsize, "%llx", bitmask);
+	if(maskp) *maskp = mask;
+	cpumask_hex(&mask, buf, bufsize);
 	return 0;
 }
 
 /* create a mask with cpu */
-static int cpu_mask(unsigned long long *bitmaskp, char *buf, size_t bufsize, int cpu)
+static int cpu_mask(struct cpumask *maskp, char *buf, size_t bufsize, int cpu)
 {
-	unsigned long long bitmask = 0;
+	struct cpumask mask;
 	
-	bitmask = (uint64_t) 1 << cpu;
+	cpumask_zero(&mask);
+	cpumask_set(&mask, cpu);
 	
-	if(bitmaskp) *bitmaskp = bitmask;
-	snprintf(buf, bufsize, "%llx", bitmask);
+	if(maskp) *maskp = mask;
+	cpumask_hex(&mask, buf, bufsize);
 	return 0;
 }
 
-static int reset_multiq(const struct dev *dev)
+/* create a mask with all online cpus */
+static int all_cpu_mask(struct cpumask *maskp, char *buf, size_t bufsize)
 {
+	struct cpumask mask;
 	int i;
-	unsigned long long cpu = 0;
-	char fn[256], buf[10];
+	
+	cpumask_zero(&mask);
+	for(i=0;i<var.nr_cpu;i++)
+		cpumask_set(&mask, i);
+	
+	if(maskp) *maskp = mask;
+	cpumask_hex(&mask, buf, bufsize);
+	return 0;
+}
+
+/* mask file in the /proc/irq/N directory dir, NULL if missing */
+static char *irq_mask_read(const char *dir, const char *name)
+{
+	char fn[256], buf[CPUMASK_SIZE];
 	int fd, n;
+
+	if(snprintf(fn, sizeof(fn), "%s/%s", dir, name) >= (int)sizeof(fn))
+		return NULL;
+	fd = open(fn, O_RDONLY);
+	if(fd == -1)
+		return NULL;
+	n = read(fd, buf, sizeof(buf)-1);
+	close(fd);
+	if(n <= 1)
+		return NULL;
+	buf[n-1] = 0;
+	return arena_strdup(var.arena, buf);
+}
+
+/*
+ * Plan entries: what to write where, and why.
+ * The planner functions below only decide masks, plan_apply() does the I/O.
+ */
+static struct plan *plan_add(const char *type, struct dev *dev, struct queue *q,
+			     const char *mask, const char *reason)
+{
+	struct plan *e;
+	char fn[256];
+
+	/* the kernel owns the affinity of managed irqs */
+	if(!strcmp(type, "irq") && (q ? q->managed : dev->managed))
+		return NULL;
+
+	e = arena_alloc(var.arena, sizeof(struct plan));
+	if(!e) return NULL;
+
+	/* irq queues keep the /proc/irq/N directory in fn */
+	if(!strcmp(type, "irq"))
+		snprintf(fn, sizeof(fn), "%s/smp_affinity", q ? q->fn : dev->fn);
+	else
+		snprintf(fn, sizeof(fn), "%s", q->fn);
+
+	e->type = type;
+	e->reason = reason;
+	e->dev = dev;
+	e->q = q;
+	e->fn = arena_strdup(var.arena, fn);
+	e->mask = arena_strdup(var.arena, mask);
+	e->result = APPLY_NONE;
+	if(q)
+		q->new_affinity = e->mask;
+	else
+		dev->new_affinity = e->mask;
+	jl_append(var.plan, e);
+	return e;
+}
+
+static int reset_multiq(struct dev *dev)
+{
+	int i;
+	char buf[CPUMASK_SIZE];
 	struct queue *q;
 	
-	for(i=0;i<var.nr_cpu;i++) {
-		cpu |= (1 << i);
-	}
-	snprintf(buf, sizeof(buf), "%llx", cpu);
+	all_cpu_mask(NULL, buf, sizeof(buf));
 	
-	for(i=0,q=jl_head_first(dev->rxq);i<dev->rx;i++,q=jl_next(q)) {
-		snprintf(fn, sizeof(fn), "%s/smp_affinity", q->fn);
-		if(!conf.quiet) {
-			if(conf.verbose)
-				printf("irq: cpu %s [mask 0x%s] -> %s %s\n",
-				       demask(buf), buf, q->name, fn);
-			else
-				printf("irq %s -> %s\n", demask(buf), q->name);
-		}
-
-		if(!conf.dryrun) {
-			fd = open(fn, O_WRONLY);
-			if(fd == -1) {
-				if(!conf.silent)
-					fprintf(stderr,
-						"Failed to open '%s'\n", fn);
-				return -1;
-			}
-			
-			n = strlen(buf);
-			if(write(fd, buf, n)!=n) {
-				close(fd);
-				return -1;
-			}
-			close(fd);
-		}		
-	}
+	for(i=0,q=jl_head_first(dev->rxq);i<dev->rx;i++,q=jl_next(q))
+		plan_add("irq", dev, q, buf, "reset");
 
-	for(i=0,q=jl_head_first(dev->txq);i<dev->tx;i++,q=jl_next(q)) {
-		snprintf(fn, sizeof(fn), "%s/smp_affinity", q->fn);
-		if(!conf.quiet) {
-			if(conf.verbose)
-				printf("irq: cpu %s [mask 0x%s] -> %s %s\n",
-				       demask(buf), buf, q->name, fn);
-			else
-				printf("irq %s -> %s\n", demask(buf), q->name);
-		}
-		
-		if(!conf.dryrun) {
-			fd = open(fn, O_WRONLY);
-			if(fd == -1) {
-				if(!conf.silent)
-					fprintf(stderr,
-						"Failed to open '%s'\n", fn);
-				return -1;
-			}
-			
-			n = strlen(buf);
-			if(write(fd, buf, n)!=n) {
-				close(fd);
-				return -1;
-			}
-			close(fd);
-		}		
-	}
+	for(i=0,q=jl_head_first(dev->txq);i<dev->tx;i++,q=jl_next(q))
+		plan_add("irq", dev, q, buf, "reset");
 
-	for(i=0,q=jl_head_first(dev->txrxq);i<dev->txrx;i++,q=jl_next(q)) {
-		snprintf(fn, sizeof(fn), "%s/smp_affinity", q->fn);
-		if(!conf.quiet) {
-			if(conf.verbose)
-				printf("irq: cpu %s [mask 0x%s] -> %s %s\n",
-				       demask(buf), buf, q->name, fn);
-			else
-				printf("irq %s -> %s\n", demask(buf), q->name);
-		}
-		
-		if(!conf.dryrun) {
-			fd = open(fn, O_WRONLY);
-			if(fd == -1) {
-				if(!conf.silent)
-					fprintf(stderr, 
-						"Failed to open '%s'\n", fn);
-				return -1;
-			}
-			
-			n = strlen(buf);
-			if(write(fd, buf, n)!=n) {
-				close(fd);
-				return -1;
-			}
-			close(fd);
-		}		
-	}
+	for(i=0,q=jl_head_first(dev->txrxq);i<dev->txrx;i++,q=jl_next(q))
+		plan_add("irq", dev, q, buf, "reset");
 
-	for(i=0,q=jl_head_first(dev->rpsq);i<dev->rps;i++,q=jl_next(q)) {
-		if(!conf.quiet) {
-			if(conf.verbose)
-				printf("rps: 00 -> %s %s\n", dev->name, q->fn);
-			else
-				printf("rps 00 -> %s\n", dev->name);
-		}
-		
-		if(!conf.dryrun) {
-			fd = open(q->fn, O_WRONLY);
-			if(fd == -1) {
-				if(!conf.silent)
-					fprintf(stderr, 
-						"Failed to open '%s'\n",
-						q->fn);
-				return -1;
-			}
-			write(fd, "00\n", 3);
-			close(fd);
-		}
-	}
+	for(i=0,q=jl_head_first(dev->rpsq);i<dev->rps;i++,q=jl_next(q))
+		plan_add("rps", dev, q, "00", "reset");
 
 	return 0;
 }
 
-static int reset_singleq(const struct dev *dev)
+static int reset_singleq(struct dev *dev)
 {
 	int i;
-	unsigned long long cpu = 0;
-	char fn[256], buf[8];
-	int fd, n;
+	char buf[CPUMASK_SIZE];
 	struct queue *q;
 
-	snprintf(fn, sizeof(fn), "%s/smp_affinity", dev->fn);
-	
-	for(i=0;i<var.nr_cpu;i++) {
-		cpu |= (1 << i);
-	}
-	snprintf(buf, sizeof(buf), "%llx", cpu);
+	all_cpu_mask(NULL, buf, sizeof(buf));
+	plan_add("irq", dev, NULL, buf, "reset");
 
-	if(!conf.quiet) {
-		if(conf.verbose)
-			printf("irq: cpu %s [mask 0x%s] -> %s %s\n",
-			       demask(buf), buf, dev->name, fn);
-		else
-			printf("irq %s -> %s\n", demask(buf), dev->name);
-	}
-	
-	if(!conf.dryrun) {
-		fd = open(fn, O_WRONLY);
-		if(fd == -1) {
-			if(!conf.silent)
-				fprintf(stderr,
-					"Failed to open '%s'\n", fn);
-			return -1;
-		}
-      
-		n = strlen(buf);
-		if(write(fd, buf, n)!=n) {
-			close(fd);
-			return -1;
-		}
-		close(fd);
+	for(i=0,q=jl_head_first(dev->rpsq);i<dev->rps;i++,q=jl_next(q))
+		plan_add("rps", dev, q, "00", "reset");
+
+	return 0;
+}
+
+static struct queue *queue_n(struct jlhead *l, int n)
+{
+	struct queue *q;
+
+	jl_foreach(l, q)
+		if(q->n == n)
+			return q;
+	return NULL;
+}
+
+/* mask from a sysfs cpulist of cpu */
+static int cpu_listattr(int cpu, const char *attr, struct cpumask *mask)
+{
+	char fn[256], buf[CPULIST_SIZE];
+	int fd, n;
+
+	snprintf(fn, sizeof(fn), "%s/devices/system/cpu/cpu%d/%s",
+		 conf.sysdir, cpu, attr);
+	fd = open(fn, O_RDONLY);
+	if(fd == -1)
+		return -1;
+	n = read(fd, buf, sizeof(buf)-1);
+	close(fd);
+	if(n <= 0)
+		return -1;
+	buf[n] = 0;
+	return cpumask_parselist(mask, buf);
+}
+
+/* usable CPUs first..last-1 of a device. multiqueue devices may use
+   the reserved CPUs with --no-reserve-mq */
+static void dev_range(const struct dev *dev, int *first, int *last)
+{
+	*first = var.cpu_offset;
+	*last = var.cpu_offset + var.nr_use_cpu;
+	if( (!conf.reserve_mq) && ( (dev->rx+dev->txrx) >1) ) {
+		*first = 0;
+		*last = var.nr_cpu;
 	}
+}
 
-	for(i=0,q=jl_head_first(dev->rpsq);i<dev->rps;i++,q=jl_next(q)) {
-		if(!conf.quiet) {
-			if(conf.verbose)
-				printf("rps: 00 -> %s %s\n", dev->name, q->fn);
-			else
-				printf("rps 00 -> %s\n", dev->name);
-		}
-		
-		if(!conf.dryrun) {
-			fd = open(q->fn, O_WRONLY);
-			if(fd == -1) {
-				if(!conf.silent)
-					fprintf(stderr,
-						"Failed to open '%s'\n", q->fn);
-				return -1;
-			}
-			write(fd, "00\n", 3);
-			close(fd);
+/* the next CPU after cpu sharing its core, else its last level cache.
+   Only CPUs in first..last-1 and outside var.avoid qualify */
+static int cpu_neighbour(int cpu, int first, int last)
+{
+	static const char *attrs[] = { "topology/thread_siblings_list",
+				       "cache/index3/shared_cpu_list", NULL };
+	struct cpumask mask;
+	int i, c, n;
+
+	for(i=0;attrs[i];i++) {
+		if(cpu_listattr(cpu, attrs[i], &mask))
+			continue;
+		for(c=1;c<var.nr_cpu;c++) {
+			n = (cpu+c) % var.nr_cpu;
+			if(n < first || n >= last || cpumask_isset(&var.avoid, n))
+				continue;
+			if(cpumask_isset(&mask, n))
+				return n;
 		}
 	}
-	return 0;
+	return cpu;
 }
 
 /*
@@ -472,24 +614,19 @@ static int reset_singleq(const struct dev *dev)
  * If there are not enough CPUs we do round-robin
  *
  */
-static int aff_multiq(const struct dev *dev)
+static int aff_multiq(struct dev *dev)
 {
 	struct jlhead *cpulist = NULL;
 	struct cpu *_cpu;
-	char fn[256], buf[16];
-	int fd, n;
+	char buf[CPUMASK_SIZE];
+	const char *reason;
 	int i, cpu;
 	int rps_cpu = -1;
 	struct queue *q, *xq;
 	int cpu_offset, nr_use_cpu;
 	
-	cpu_offset = var.cpu_offset;
-	nr_use_cpu = var.nr_use_cpu;	
-	
-	if( (!conf.reserve_mq) && ( (dev->rx+dev->txrx) >1) ) {
-		nr_use_cpu = var.nr_cpu;
-		cpu_offset = 0;
-	}
+	dev_range(dev, &cpu_offset, &nr_use_cpu);
+	nr_use_cpu -= cpu_offset;
 	
 	if(conf.memnode_dist) {
 		//cpulist = memnodes_cpu_select(nr_use_cpu, cpu_offset);
@@ -499,54 +636,57 @@ static int aff_multiq(const struct dev *dev)
 	for(i=nr_use_cpu-cpu_offset,q=jl_head_first(dev->rxq);
 	    q;
 	    i++,q=jl_next(q)) {
-		snprintf(fn, sizeof(fn), "%s/smp_affinity", q->fn);
-		if(dev->rr_multi)
+		if(q->assigned_cpu >= 0) {
+			/* pre-assigned by the placement strategy */
+			cpu = q->assigned_cpu;
+			reason = q->reason;
+		} else if(dev->rr_multi) {
 			cpu = (var.cur_mq_cpu++ % nr_use_cpu) + cpu_offset;
-		else
+			reason = "round-robin";
+		} else {
 			cpu = (i % nr_use_cpu) + cpu_offset;
+			reason = "queue";
+		}
 		
 		q->assigned_cpu = cpu;
 		rps_cpu = cpu;
 		
-		snprintf(buf, sizeof(buf), "%llx", (uint64_t) 1 << cpu);
-		
-		if(!conf.quiet) {
-			if(conf.verbose)
-				printf("irq: cpu %d [mask 0x%s] -> %s@%d %s\n",
-				       cpu, buf, q->name, dev->numa_node, fn);
-			else
-				printf("irq %d -> %s\n", cpu, q->name);
-		}
-		
-		if(!conf.dryrun) {
-			fd = open(fn, O_WRONLY);
-			if(fd == -1) {
-				if(!conf.silent)
-					fprintf(stderr, 
-						"Failed to open '%s'\n", fn);
-				return -1;
-			}
-			
-			n = strlen(buf);
-			if(write(fd, buf, n)!=n) {
-				close(fd);
-				return -1;
-			}
-			close(fd);
-		}
+		cpu_mask(NULL, buf, sizeof(buf), cpu);
+		plan_add("irq", dev, q, buf, reason);
 	}
 
 	for(i=nr_use_cpu-cpu_offset,q=jl_head_first(dev->txq);
 	    q;
 	    i++,q=jl_next(q)) {
-		snprintf(fn, sizeof(fn), "%s/smp_affinity", q->fn);
 		cpu = (i % nr_use_cpu) + cpu_offset;
+		reason = "queue";
 
 		/* single tx and rx queue: keep same cpu as for rx */
-		if( (dev->tx == 1) && (dev->rx == 1) )
+		if( (dev->tx == 1) && (dev->rx == 1) ) {
 			cpu = rps_cpu;
+			reason = "rx cpu";
+		}
+		if(dev->pair_tx && (xq = queue_n(dev->rxq, q->n)) ) {
+			cpu = xq->assigned_cpu;
+			reason = "queue pair";
+		}
+		if(q->assigned_cpu >= 0) {
+			/* pre-assigned by the strategy or a group */
+			cpu = q->assigned_cpu;
+			reason = q->reason;
+		} else if(conf.tx_sibling &&
+			  (xq = queue_n(dev->rxq, q->n)) ) {
+			/* tx completions next to rx-N, not preempting it */
+			int c = cpu_neighbour(xq->assigned_cpu, cpu_offset,
+					      cpu_offset + nr_use_cpu);
+			if(c != xq->assigned_cpu) {
+				cpu = c;
+				reason = "rx sibling";
+			}
+		}
 		
-		snprintf(buf, sizeof(buf), "%llx", (uint64_t) 1 << cpu);
+		q->assigned_cpu = cpu;
+		cpu_mask(NULL, buf, sizeof(buf), cpu);
 
 		if(dev->xps) {
 			/* assign the same cpu to the xps queue */
@@ -554,45 +694,27 @@ static int aff_multiq(const struct dev *dev)
 			if(xq) xq->assigned_cpu = cpu;
 		}
 		
-		if(!conf.quiet) {
-			if(conf.verbose)
-				printf("irq: cpu %d [mask 0x%s] -> %s@%d %s\n",
-				       cpu, buf, q->name, dev->numa_node, fn);
-			else
-				printf("irq %d -> %s\n", cpu, q->name);
-		}
-		
-		if(!conf.dryrun) {
-			fd = open(fn, O_WRONLY);
-			if(fd == -1) {
-				if(!conf.silent)
-					fprintf(stderr, 
-						"Failed to open '%s'\n", fn);
-				return -1;
-			}
-			
-			n = strlen(buf);
-			if(write(fd, buf, n)!=n) {
-				close(fd);
-				return -1;
-			}
-			close(fd);
-		}
+		plan_add("irq", dev, q, buf, reason);
 	}
 
 	for(i=nr_use_cpu-cpu_offset,q=jl_head_first(dev->txrxq);
 	    q;
 	    i++,q=jl_next(q)) {
-		snprintf(fn, sizeof(fn), "%s/smp_affinity", q->fn);
-		if(conf.memnode_dist) {
+		if(q->assigned_cpu >= 0) {
+			cpu = q->assigned_cpu;
+			reason = q->reason;
+		} else if(conf.memnode_dist) {
 			_cpu = jl_at(cpulist, i % nr_use_cpu);
 			if(_cpu)
 				cpu = _cpu->cpu;
 			else
 				cpu = 0;
-		} else
+			reason = "node distribution";
+		} else {
 			cpu = (i % nr_use_cpu) + cpu_offset;
-		snprintf(buf, sizeof(buf), "%llx", (uint64_t) 1 << cpu);
+			reason = "queue";
+		}
+		cpu_mask(NULL, buf, sizeof(buf), cpu);
 
 		q->assigned_cpu = cpu;
 		rps_cpu = cpu;
@@ -602,100 +724,20 @@ static int aff_multiq(const struct dev *dev)
 			if(xq) xq->assigned_cpu = cpu;
 		}
 		
-		if(!conf.quiet) {
-			if(conf.verbose)
-				printf("irq: cpu %d [mask 0x%s] -> %s@%d %s\n",
-				       cpu, buf, q->name, dev->numa_node, fn);
-			else
-				printf("irq %d -> %s\n", cpu, q->name);
-		}
-		if(!conf.dryrun) {
-			fd = open(fn, O_WRONLY);
-			if(fd == -1) {
-				if(!conf.silent)
-					fprintf(stderr,
-						"Failed to open '%s'\n", fn);
-				return -1;
-			}
-			
-			n = strlen(buf);
-			if(write(fd, buf, n)!=n) {
-				close(fd);
-				return -1;
-			}
-			close(fd);
-		}
+		plan_add("irq", dev, q, buf, reason);
 	}
 
 	if(dev->use_rps) {
 		node_cpu_mask(NULL, buf, sizeof(buf), rps_cpu);
-		jl_foreach(dev->rpsq, q) {
-			if(!conf.quiet) {
-				if(conf.verbose)
-					printf("rps: cpu %s [mask 0x%s] -> %s@%d %s\n",
-					       demask(buf),
-					       buf,
-					       q->name,
-					       dev->numa_node,
-					       q->fn);
-				else
-					printf("rps %s -> %s\n",
-					       demask(buf), q->name);
-			}
-			
-			if(!conf.dryrun) {
-				fd = open(q->fn, O_WRONLY);
-				if(fd == -1) {
-					if(!conf.silent)
-						fprintf(stderr,
-							"Failed to open '%s'\n",
-							q->fn);
-					return -1;
-				}
-				n = strlen(buf);
-				if(write(fd, buf, n)!=n) {
-					close(fd);
-					return -1;
-				}
-				close(fd);
-			}
-		}
+		jl_foreach(dev->rpsq, q)
+			plan_add("rps", dev, q, buf, "irq node");
 	}
 
 	if(dev->use_xps) {
 		jl_foreach(dev->xpsq, q) {
 			cpu_mask(NULL, buf, sizeof(buf),
 				      q->assigned_cpu >= 0 ? q->assigned_cpu : 0);
-			if(!conf.quiet) {
-				if(conf.verbose)
-					printf("xps: cpu %s [mask 0x%s] -> %s-%d@%d %s\n",
-					       demask(buf),
-					       buf,
-					       q->name,
-					       q->n,
-					       dev->numa_node,
-					       q->fn);
-				else
-					printf("xps %s -> %s-%d\n",
-					       demask(buf), q->name, q->n);
-			}
-			
-			if(!conf.dryrun) {
-				fd = open(q->fn, O_WRONLY);
-				if(fd == -1) {
-					if(!conf.silent)
-						fprintf(stderr,
-							"Failed to open '%s'\n",
-							q->fn);
-					return -1;
-				}
-				n = strlen(buf);
-				if(write(fd, buf, n)!=n) {
-					close(fd);
-					return -1;
-				}
-				close(fd);
-			}
+			plan_add("xps", dev, q, buf, "tx cpu");
 		}
 	}
 	
@@ -707,121 +749,269 @@ static int aff_multiq(const struct dev *dev)
  */
 static int aff_singleq(struct dev *dev)
 {
-	char fn[256], buf[8];
-	int fd, n, cpu;
+	char buf[CPUMASK_SIZE];
+	const char *reason;
+	int cpu;
 	struct queue *q;
 	
-	snprintf(fn, sizeof(fn), "%s/smp_affinity", dev->fn);
-	
-	if(conf.rr_single)
+	if(dev->assigned_cpu >= 0) {
+		cpu = dev->assigned_cpu;
+		reason = dev->reason;
+	} else if(conf.rr_single) {
 		cpu = (var.cur_cpu++ % var.nr_use_cpu) + var.cpu_offset;
-	else
+		reason = "round-robin";
+	} else {
 		cpu = var.cpu_offset;
+		reason = "first cpu";
+	}
 
 	dev->assigned_cpu = cpu;
 	
-	snprintf(buf, sizeof(buf), "%x", 1 << cpu);
-	
-	if(!conf.quiet) {
-		if(conf.verbose)
-			printf("irq: cpu %d [mask 0x%s] -> %s@%d %s\n", cpu, buf, dev->name, dev->numa_node, fn);
-		else
-			printf("irq %d -> %s\n", cpu, dev->name);
-	}
-	
-	if(!conf.dryrun) {
-		fd = open(fn, O_WRONLY);
-		if(fd == -1) {
-			if(!conf.silent)
-				fprintf(stderr, "Failed to open '%s'\n", fn);
-			return -1;
-		}
-      
-		n = strlen(buf);
-		if(write(fd, buf, n)!=n) {
-			close(fd);
-			return -1;
-		}
-		close(fd);
-	}
+	cpu_mask(NULL, buf, sizeof(buf), cpu);
+	plan_add("irq", dev, NULL, buf, reason);
 	
 	node_cpu_mask(NULL, buf, sizeof(buf), dev->assigned_cpu);
 	if(dev->use_rps) {
-		jl_foreach(dev->rpsq, q) {
-			if(!conf.quiet) {
-				if(conf.verbose)
-					printf("rps: cpu %s [mask 0x%s] -> %s@%d %s\n",
-					       demask(buf),
-					       buf,
-					       dev->name,
-					       dev->numa_node,
-					       q->fn);
-				else
-					printf("rps %s -> %s\n",
-					       demask(buf), dev->name);
-			}
-			
-			if(!conf.dryrun) {
-				fd = open(q->fn, O_WRONLY);
-				if(fd == -1) {
-					if(!conf.silent)
-						fprintf(stderr, 
-							"Failed to open '%s'\n",
-							q->fn);
-					return -1;
-				}
-				n = strlen(buf);
-				if(write(fd, buf, n)!=n) {
-					close(fd);
-					return -1;
-				}
-				close(fd);
-			}
-		}
+		jl_foreach(dev->rpsq, q)
+			plan_add("rps", dev, q, buf, "irq node");
 	}
 
 	return 0;
 }
 
-int dev_rx(const char *name)
+/* does the entry change the current mask */
+static int plan_changed(const struct plan *e)
 {
-	int q;
-	char *p;
-	
-	p = strstr(name, "-rx-");
-	if(p) {
-		if(sscanf(p+4, "%d", &q)==1)
-			return q+1;
-	}
-	return 0;
+	struct cpumask old, new;
+	const char *oldmask;
+
+	oldmask = e->q ? e->q->old_affinity : e->dev->old_affinity;
+	if(cpumask_parse(&old, oldmask) || cpumask_parse(&new, e->mask))
+		return 1;
+	return memcmp(&old, &new, sizeof(old)) != 0;
 }
 
-int dev_txrx(const char *name)
+/* name of what an entry sets. xps queues are named after the device */
+static const char *plan_label(const struct plan *e, char *buf, size_t size)
 {
-	int q;
-	char *p;
-	
-	p = strstr(name, "-txrx-");
-	if(!p) p = strstr(name, "-rxtx-");
-	if(!p) p = strstr(name, "-TxRx-");
-	if(p) {
-		if(sscanf(p+6, "%d", &q)==1)
-			return q+1;
-	}
-	return 0;
+	if(e->q && !strcmp(e->type, "xps"))
+		snprintf(buf, size, "%s-%d", e->q->name, e->q->n);
+	else
+		snprintf(buf, size, "%s", e->q ? e->q->name : e->dev->name);
+	return buf;
 }
 
-int dev_tx(const char *name)
+static void plan_print(const struct plan *e)
 {
-	int q;
-	char *p;
-	
-	p = strstr(name, "-tx-");
-	if(p) {
-		if(sscanf(p+4, "%d", &q)==1)
-			return q+1;
+	char cpubuf[CPULIST_SIZE], oldbuf[CPULIST_SIZE], label[64];
+	const char *oldmask, *cpus, *oldcpus;
+
+	plan_label(e, label, sizeof(label));
+	cpus = demask(e->mask, cpubuf, sizeof(cpubuf));
+
+	if(conf.diff) {
+		oldmask = e->q ? e->q->old_affinity : e->dev->old_affinity;
+		oldcpus = demask(oldmask, oldbuf, sizeof(oldbuf));
+		if(conf.verbose)
+			printf("%s: %s cpu %s -> %s [mask 0x%s -> 0x%s] (%s) %s\n",
+			       e->type, label, oldcpus, cpus,
+			       oldmask, e->mask, e->reason, e->fn);
+		else
+			printf("%s %s: %s -> %s (%s)\n",
+			       e->type, label, oldcpus, cpus, e->reason);
+		return;
 	}
-	return 0;
+
+	if(!strcmp(e->reason, "reset")) {
+		if(!strcmp(e->type, "rps")) {
+			if(conf.verbose)
+				printf("rps: %s -> %s %s\n", e->mask, e->dev->name, e->fn);
+			else
+				printf("rps %s -> %s\n", e->mask, e->dev->name);
+		} else {
+			if(conf.verbose)
+				printf("irq: cpu %s [mask 0x%s] -> %s %s\n",
+				       cpus, e->mask, label, e->fn);
+			else
+				printf("irq %s -> %s\n", cpus, label);
+		}
+		return;
+	}
+
+	if(conf.verbose)
+		printf("%s: cpu %s [mask 0x%s] -> %s@%d %s\n",
+		       e->type, cpus, e->mask, label, e->dev->numa_node, e->fn);
+	else
+		printf("%s %s -> %s\n", e->type, cpus, label);
+}
+
+/*
+ * Write the masks of a plan. A device is skipped after its first failure.
+ * EIO from smp_affinity means the kernel manages the irq. It is not an
+ * error; the irq is marked managed and the device carries on.
+ */
+static int plan_apply(struct jlhead *plan)
+{
+	struct plan *e;
+	const struct dev *dev = NULL, *failed = NULL;
+	char buf[CPUMASK_SIZE+1];
+	int fd, n, rc = 0;
+
+	jl_foreach(plan, e) {
+		if(e->dev == failed)
+			continue;
+		if(conf.diff && !plan_changed(e))
+			continue;
+
+		if(conf.json) {
+			if(e->dev != dev)
+				json_dev(e->dev);
+			json_queue(e->type, e->dev, e->q, e->reason);
+		} else if(!conf.quiet)
+			plan_print(e);
+		dev = e->dev;
+
+		if(conf.dryrun)
+			continue;
+		/* O_TRUNC is a no-op on sysfs and procfs but keeps
+		   synthetic trees (gen-systree.sh) readable */
+		fd = open(e->fn, O_WRONLY|O_TRUNC);
+		if(fd == -1) {
+			if(!conf.silent)
+				fprintf(stderr, "Failed to open '%s'\n", e->fn);
+			failed = e->dev;
+			rc = -1;
+			continue;
+		}
+		/* newline terminated, as echo would write it */
+		n = snprintf(buf, sizeof(buf), "%s\n", e->mask);
+		e->result = APPLY_OK;
+		if(write(fd, buf, n)!=n) {
+			if(errno == EIO && !strcmp(e->type, "irq")) {
+				e->result = APPLY_MANAGED;
+				if(e->q)
+					e->q->managed = 1;
+				else
+					e->dev->managed = 1;
+			} else {
+				e->result = APPLY_FAILED;
+				failed = e->dev;
+				rc = -1;
+			}
+		}
+		close(fd);
+	}
+	return rc;
+}
+
+/*
+ * Read back effective_affinity of the irqs written. The kernel may use
+ * any CPU of the mask; one outside it means the mask did not take
+ * (vector exhaustion, interrupt remapping, another tool writing).
+ */
+static int plan_verify(struct jlhead *plan)
+{
+	struct plan *e;
+	struct cpumask want, got;
+	char cpus[CPULIST_SIZE], wantcpus[CPULIST_SIZE];
+	char *eff;
+	int applied = 0, managed = var.nmanaged, mismatched = 0;
+
+	jl_foreach(plan, e) {
+		if(strcmp(e->type, "irq"))
+			continue;
+		if(e->result == APPLY_MANAGED) {
+			managed++;
+			if(conf.verbose)
+				printf("irq %s: managed by the kernel, left alone\n",
+				       e->q ? e->q->name : e->dev->name);
+			continue;
+		}
+		if(e->result != APPLY_OK)
+			continue;
+		eff = irq_mask_read(e->q ? e->q->fn : e->dev->fn, "effective_affinity");
+		if(e->q)
+			e->q->effective = eff;
+		else
+			e->dev->effective = eff;
+		/* empty until the irq has fired on some kernels */
+		if(eff && !cpumask_parse(&got, eff) && cpumask_weight(&got) &&
+		   !cpumask_parse(&want, e->mask) && !cpumask_subset(&got, &want)) {
+			e->result = APPLY_MISMATCH;
+			mismatched++;
+			if(!conf.silent)
+				fprintf(stderr, "irq %s: effective affinity cpu %s,"
+					" wanted cpu %s\n",
+					e->q ? e->q->name : e->dev->name,
+					demask(eff, cpus, sizeof(cpus)),
+					demask(e->mask, wantcpus, sizeof(wantcpus)));
+			continue;
+		}
+		applied++;
+	}
+
+	if(conf.json)
+		printf("{\"type\":\"verify\",\"applied\":%d,\"managed\":%d"
+		       ",\"mismatched\":%d}\n", applied, managed, mismatched);
+	else if(conf.verbose)
+		printf("Verify: %d applied, %d managed, %d mismatched.\n",
+		       applied, managed, mismatched);
+	return mismatched ? -1 : 0;
+}
+
+/*
+ * --verify: compare the plan with the masks in effect, without writing.
+ * An irq has also drifted when the kernel runs it outside the mask
+ * planned for it. Returns the exit status: 0 without drift, 2 with.
+ */
+static int plan_drift(struct jlhead *plan)
+{
+	struct plan *e;
+	struct cpumask want, got;
+	char cpus[CPULIST_SIZE], newcpus[CPULIST_SIZE], label[64];
+	const char *oldmask, *eff;
+	int n = 0, drift;
+
+	jl_foreach(plan, e) {
+		oldmask = e->q ? e->q->old_affinity : e->dev->old_affinity;
+		eff = NULL;
+		if(!strcmp(e->type, "irq"))
+			eff = e->q ? e->q->effective : e->dev->effective;
+		drift = plan_changed(e);
+		if(!drift && eff && !cpumask_parse(&got, eff) && cpumask_weight(&got) &&
+		   !cpumask_parse(&want, e->mask) && !cpumask_subset(&got, &want)) {
+			drift = 1;
+			oldmask = eff;
+		}
+		if(!drift)
+			continue;
+		n++;
+		if(conf.json) {
+			json_queue(e->type, e->dev, e->q, e->reason);
+			continue;
+		}
+		if(conf.quiet)
+			continue;
+		plan_label(e, label, sizeof(label));
+		if(conf.verbose)
+			printf("drift %s %s: cpu %s, planned %s (%s) %s\n",
+			       e->type, label,
+			       demask(oldmask, cpus, sizeof(cpus)),
+			       demask(e->mask, newcpus, sizeof(newcpus)),
+			       e->reason, e->fn);
+		else
+			printf("drift %s %s: cpu %s, planned %s\n",
+			       e->type, label,
+			       demask(oldmask, cpus, sizeof(cpus)),
+			       demask(e->mask, newcpus, sizeof(newcpus)));
+	}
+
+	if(conf.json)
+		printf("{\"type\":\"verify\",\"targets\":%d,\"drift\":%d}\n",
+		       plan->len, n);
+	else if(conf.verbose)
+		printf("Verify: %d of %d targets drifted.\n", n, plan->len);
+	return n ? 2 : 0;
 }
 
 int qcmp(const void *i1, const void *i2)
@@ -838,10 +1028,79 @@ int devcmp(const void *i1, const void *i2)
 	return strcmp(d1->name, d2->name);
 }
 
+/* read /sys/class/net/<dev>/<attr> without the trailing newline */
+static int dev_attr(const struct dev *dev, const char *attr, char *buf, size_t size)
+{
+	char fn[256];
+	int fd, n;
+
+	snprintf(fn, sizeof(fn), "%s/class/net/%s/%s", conf.sysdir, dev->name, attr);
+	fd = open(fn, O_RDONLY);
+	if(fd == -1)
+		return -1;
+	n = read(fd, buf, size-1);
+	close(fd);
+	if(n <= 0)
+		return -1;
+	buf[n] = 0;
+	if(buf[n-1] == '\n')
+		buf[n-1] = 0;
+	return 0;
+}
+
+static int dev_attr_write(const struct dev *dev, const char *attr, const char *value)
+{
+	char fn[256], buf[64];
+	int fd, n, rc = 0;
+
+	snprintf(fn, sizeof(fn), "%s/class/net/%s/%s", conf.sysdir, dev->name, attr);
+	fd = open(fn, O_WRONLY|O_TRUNC);
+	if(fd == -1)
+		return -1;
+	n = snprintf(buf, sizeof(buf), "%s\n", value);
+	if(write(fd, buf, n) != n)
+		rc = -1;
+	close(fd);
+	return rc;
+}
+
+/* driver bound to a netdev, "" if not known */
+static const char *netdev_driver(const char *name, char *buf, size_t size)
+{
+	char fn[256], *p;
+	int n;
+
+	if(snprintf(fn, sizeof(fn), "%s/class/net/%s/device/driver",
+		    conf.sysdir, name) >= (int)sizeof(fn))
+		return "";
+	n = readlink(fn, buf, size-1);
+	if(n <= 0)
+		return "";
+	buf[n] = 0;
+	p = strrchr(buf, '/');
+	return p ? p+1 : buf;
+}
+
+/* device not left out by --exclude or --devices */
+static int dev_wanted(const char *name)
+{
+	char *ifname;
+
+	jl_foreach(conf.exclude, ifname)
+		if(!strcmp(ifname, name))
+			return 0;
+	if(!conf.limit->len)
+		return 1;
+	jl_foreach(conf.limit, ifname)
+		if(!strcmp(ifname, name))
+			return 1;
+	return 0;
+}
+
 struct dev *dev_get(struct jlhead *l, const char *dname)
 {
 	struct dev *dev;
-	char name[16], *p, *ifname;
+	char name[16], *p;
 	int fd, n;
 	char fn[256];
 	char buf[8];
@@ -854,36 +1113,24 @@ struct dev *dev_get(struct jlhead *l, const char *dname)
 	p = strchr(name, ':');
 	if(p) *p=0;
 	
-	if(conf.exclude->len) {
-		jl_foreach(conf.exclude, ifname) {
-			if(!strcmp(ifname, name))
-				return NULL;
-		}
-	}
-  
-	if(conf.limit->len) {
-		jl_foreach(conf.limit, ifname) {
-			if(!strcmp(ifname, name))
-				goto ok;
-		}
+	if(!dev_wanted(name))
 		return NULL;
-	}
-	
-ok:
+
 	jl_foreach(l, dev) {
 		if(!strcmp(dev->name, name))
 			return dev;
 	}
-	dev = malloc(sizeof(struct dev));
+	dev = arena_alloc(var.arena, sizeof(struct dev));
 	if(dev) {
 		memset(dev, 0, sizeof(struct dev));
-		dev->name = strdup(name);
+		dev->name = arena_strdup(var.arena, name);
 		dev->rxq = jl_new();
 		dev->txq = jl_new();
 		dev->txrxq = jl_new();
 		dev->rpsq = jl_new();
 		dev->xpsq = jl_new();
 		dev->assigned_cpu = -1;
+		dev->irq = -1;
 		dev->use_rps = 0;
 		dev->use_xps = 0;
 		jl_sort(dev->rxq, qcmp);
@@ -897,8 +1144,15 @@ ok:
 			dev->name);
 		
 		fd = open(fn, O_RDONLY);
+		if(fd == -1) {
+			/* virtio devices: the node is on the PCI device */
+			sprintf(fn, "%s/class/net/%s/device/../numa_node",
+				conf.sysdir,
+				dev->name);
+			fd = open(fn, O_RDONLY);
+		}
 		if(fd >= 0) {
-			n = read(fd, buf, sizeof(buf));
+			n = read(fd, buf, sizeof(buf)-1);
 			if(n > 0) {
 				buf[n] = 0;
 				dev->numa_node = atoi(buf);
@@ -906,6 +1160,18 @@ ok:
 			close(fd);
 		}
 
+		if(!dev_attr(dev, "ifindex", buf, sizeof(buf)))
+			dev->ifindex = atoi(buf);
+
+		/* speed is unreadable (EINVAL) while the link is down */
+		dev->speed = -1;
+		if(!dev_attr(dev, "speed", buf, sizeof(buf)))
+			dev->speed = atoi(buf);
+		if(!dev_attr(dev, "operstate", fn, sizeof(fn)))
+			dev->down = !strcmp(fn, "down") ||
+				!strcmp(fn, "lowerlayerdown");
+		dev->driver = arena_strdup(var.arena,
+					   netdev_driver(dev->name, fn, sizeof(fn)));
 	}
 	
 	return dev;
@@ -917,42 +1183,248 @@ struct queue *queue_new(const char *name, int n, const char *fn)
 
 	if(conf.maxq && n >= conf.maxq) return NULL;
 
-	q = malloc(sizeof(struct queue));
+	q = arena_alloc(var.arena, sizeof(struct queue));
 	if(q) {
-		q->fn = strdup(fn);
-		q->name = strdup(name);
+		memset(q, 0, sizeof(struct queue));
+		q->fn = arena_strdup(var.arena, fn);
+		q->name = arena_strdup(var.arena, name);
 		q->n = n;
 		q->assigned_cpu = -1;
+		q->irq = -1;
 	}
 	return q;
 }
 
-int is_netdev(const char *name)
+int is_netdev(const char *dname)
 {
-	char *p;
+	char name[IF_NAMESIZE], *p;
+	char fn[256];
+	struct stat statbuf;
 
-	name = strdup(name);
+	strncpy(name, dname, sizeof(name)-1);
+	name[sizeof(name)-1] = 0;
 	if( (p = strchr(name, '-')) ) {
 	  *p = 0;
 	}
 
+	/* devices present in sysdir. makes a synthetic --sysdir tree work */
+	snprintf(fn, sizeof(fn), "%s/class/net/%s", conf.sysdir, name);
+	if(!stat(fn, &statbuf))
+		return 1;
+
 	/* this will work with namespaces too */
 	return if_nametoindex(name);
 }
 
 
-int scan(struct jlhead *l, const struct dirent *ent, const char *base)
+enum { ROLE_NONE, ROLE_RX, ROLE_TX, ROLE_TXRX, ROLE_IGNORE };
+
+/*
+ * How drivers name their irq vectors. The number following the pattern
+ * is the queue. Rules with a driver only apply to devices bound to that
+ * driver. The first match wins. ROLE_IGNORE marks control vectors that
+ * belong to a device but serve no queue.
+ */
+struct irqrule {
+	const char *driver;
+	const char *pattern;
+	int role;
+};
+
+static const struct irqrule irqrules[] = {
+	{ "mlx5_core", "mlx5_async", ROLE_IGNORE },
+	{ "mlx5_core", "mlx5_comp", ROLE_TXRX },
+	{ "mlx4_core", "mlx4-async", ROLE_IGNORE },
+	{ "mlx4_en", "mlx4-", ROLE_TXRX },
+	{ "virtio_net", "-config", ROLE_IGNORE },
+	{ "virtio_net", "-input.", ROLE_RX },
+	{ "virtio_net", "-output.", ROLE_TX },
+	{ "ena", "ena-mgmnt", ROLE_IGNORE },
+	{ "ena", "-Tx-Rx-", ROLE_TXRX },
+	{ "gve", "gve-mgmnt", ROLE_IGNORE },
+	{ "gve", "gve-ntfy-blk", ROLE_TXRX },
+	{ "hns3", "-misc-", ROLE_IGNORE },
+	{ "hns3", "-TxRx-", ROLE_TXRX },
+	{ "qede", "-fp-", ROLE_TXRX },
+	/* naming shared by most drivers */
+	{ NULL, "-rx-", ROLE_RX },
+	{ NULL, "-tx-", ROLE_TX },
+	{ NULL, "-txrx-", ROLE_TXRX },
+	{ NULL, "-rxtx-", ROLE_TXRX },
+	{ NULL, "-TxRx-", ROLE_TXRX },
+	{ NULL, NULL, ROLE_NONE }
+};
+
+static int irq_role(const char *driver, const char *action, int *n)
+{
+	const struct irqrule *rule;
+	const char *p;
+
+	for(rule=irqrules;rule->pattern;rule++) {
+		if(rule->driver && (!driver || strcmp(rule->driver, driver)))
+			continue;
+		p = strstr(action, rule->pattern);
+		if(!p)
+			continue;
+		if(rule->role == ROLE_IGNORE)
+			return ROLE_IGNORE;
+		if(sscanf(p+strlen(rule->pattern), "%d", n)==1)
+			return rule->role;
+	}
+	return ROLE_NONE;
+}
+
+/*
+ * Owners of MSI vectors, from /sys/class/net/<dev>/device/msi_irqs.
+ * Lets queues be found whose vectors are not named after the netdev
+ * (mlx5_comp3@pci:..., virtio0-input.0). Virtio netdevs sit on a virtio
+ * device whose parent PCI device has the vectors.
+ */
+struct msi {
+	int irq;
+	char *dev; /* NULL when several netdevs share the vector */
+	char *driver;
+};
+
+static int msicmp(const void *i1, const void *i2)
+{
+	const struct msi *m1=i1, *m2=i2;
+
+	return m1->irq - m2->irq;
+}
+
+static int scan_msi()
+{
+	DIR *d, *md;
+	struct dirent *ent, *ment;
+	char fn[512], drv[256];
+	struct msi *m;
+	int size = 0, i;
+
+	var.nmsi = 0;
+	snprintf(fn, sizeof(fn), "%s/class/net", conf.sysdir);
+	d = opendir(fn);
+	if(!d) return -1;
+
+	while((ent = readdir(d))) {
+		if(ent->d_name[0] == '.')
+			continue;
+		snprintf(fn, sizeof(fn), "%s/class/net/%s/device/msi_irqs",
+			 conf.sysdir, ent->d_name);
+		md = opendir(fn);
+		if(!md) {
+			snprintf(fn, sizeof(fn), "%s/class/net/%s/device/../msi_irqs",
+				 conf.sysdir, ent->d_name);
+			md = opendir(fn);
+		}
+		if(!md)
+			continue;
+		while((ment = readdir(md))) {
+			if(ment->d_name[0] == '.')
+				continue;
+			if(var.nmsi == size) {
+				size = size ? size*2 : 256;
+				m = arena_alloc(var.arena, sizeof(struct msi) * size);
+				if(!m) break;
+				if(var.nmsi)
+					memcpy(m, var.msi, sizeof(struct msi) * var.nmsi);
+				var.msi = m;
+			}
+			m = &var.msi[var.nmsi++];
+			m->irq = atoi(ment->d_name);
+			m->dev = arena_strdup(var.arena, ent->d_name);
+			m->driver = arena_strdup(var.arena,
+						 netdev_driver(ent->d_name, drv, sizeof(drv)));
+		}
+		closedir(md);
+	}
+	closedir(d);
+
+	qsort(var.msi, var.nmsi, sizeof(struct msi), msicmp);
+	for(i=1;i<var.nmsi;i++)
+		if(var.msi[i].irq == var.msi[i-1].irq &&
+		   (!var.msi[i-1].dev || strcmp(var.msi[i].dev, var.msi[i-1].dev)))
+			var.msi[i].dev = var.msi[i-1].dev = NULL;
+	return 0;
+}
+
+static const struct msi *msi_owner(int irq)
+{
+	struct msi key;
+
+	if(!var.nmsi) return NULL;
+	key.irq = irq;
+	return bsearch(&key, var.msi, var.nmsi, sizeof(struct msi), msicmp);
+}
+
+/*
+ * Netdev of a virtio vector (virtio0-input.0), through
+ * /sys/bus/virtio/devices/virtio0/net/. Works without msi_irqs.
+ */
+static char *virtio_netdev(const char *action, char *name, size_t size)
 {
 	DIR *d;
+	struct dirent *ent;
 	char fn[256];
-	struct dev *dev = NULL;
-	int q;
+	int n;
+
+	if(sscanf(action, "virtio%d-", &n) != 1)
+		return NULL;
+	snprintf(fn, sizeof(fn), "%s/bus/virtio/devices/virtio%d/net", conf.sysdir, n);
+	d = opendir(fn);
+	if(!d) return NULL;
+	while((ent = readdir(d))) {
+		if(ent->d_name[0] == '.')
+			continue;
+		if(snprintf(name, size, "%s", ent->d_name) >= (int)size)
+			continue;
+		closedir(d);
+		return name;
+	}
+	closedir(d);
+	return NULL;
+}
+
+/*
+ * Kernel managed irqs (drivers using pci_alloc_irq_vectors_affinity())
+ * are spread by the kernel and refuse smp_affinity writes with EIO.
+ * Only the irq debugfs, when mounted, shows this without writing.
+ * sysfs has no flag for it and affinity_hint is not set reliably.
+ */
+static int irq_debug_managed(int irq)
+{
+	char fn[256], buf[1024];
+	int fd, n;
+
+	snprintf(fn, sizeof(fn), "%s/kernel/debug/irq/irqs/%d", conf.sysdir, irq);
+	fd = open(fn, O_RDONLY);
+	if(fd == -1)
+		return 0;
+	n = read(fd, buf, sizeof(buf)-1);
+	close(fd);
+	if(n <= 0)
+		return 0;
+	buf[n] = 0;
+	return strstr(buf, "AFFINITY_MANAGED") != NULL;
+}
+
+int scan(struct jlhead *l, const struct dirent *ent, const char *base)
+{
+	DIR *d;
+	char fn[256], drv[256], name[IF_NAMESIZE];
+	struct dev *dev = NULL, *owner;
+	const struct msi *msi;
+	const char *driver;
+	int q, role;
 	struct queue *queue = NULL;
+	int irq;
 	
 	if(ent->d_name[0] == '.')
 		return -1;
 	
-	snprintf(fn, sizeof(fn), "%s/%s", base, ent->d_name);
+	if(snprintf(fn, sizeof(fn), "%s/%s", base, ent->d_name) >= (int)sizeof(fn))
+		return -1;
+	irq = atoi(ent->d_name);
 	
 	d = opendir(fn);
 	if(!d) return -1;
@@ -961,54 +1433,86 @@ int scan(struct jlhead *l, const struct dirent *ent, const char *base)
 		if(ent->d_name[0] == '.')
 			continue;
 		if(is_netdev(ent->d_name)) {
-			dev = dev_get(l, ent->d_name);
-			if(dev) {
-				if((q=dev_rx(ent->d_name))) {
-					queue = queue_new(ent->d_name, q-1, fn);
-					if(queue) {
-						dev->rx++;
-						jl_ins(dev->rxq, queue);
-					}
-					continue;
-				} 
-				if((q=dev_tx(ent->d_name))) {
-					queue = queue_new(ent->d_name,
-							  q-1, fn);
-					if(queue) {
-						dev->tx++;
-						jl_ins(dev->txq, queue);
-					}
-					continue;
-				} 
-				if((q=dev_txrx(ent->d_name))) {
-					queue = queue_new(ent->d_name,
-							  q-1, fn);
-					if(queue) {
-						dev->txrx++;
-						jl_ins(dev->txrxq, queue);
-					}
-					continue;
-				}
-				dev->fn = strdup(fn); /* pure dev irq */
+			strncpy(name, ent->d_name, sizeof(name)-1);
+			name[sizeof(name)-1] = 0;
+			name[strcspn(name, "-:")] = 0;
+			driver = netdev_driver(name, drv, sizeof(drv));
+			role = irq_role(driver, ent->d_name, &q);
+			if(role == ROLE_IGNORE)
+				continue;
+			owner = dev_get(l, ent->d_name);
+		} else if(ent->d_type != DT_DIR && ent->d_type != DT_UNKNOWN) {
+			continue; /* smp_affinity and friends */
+		} else {
+			if( (msi = msi_owner(irq)) && msi->dev ) {
+				strncpy(name, msi->dev, sizeof(name)-1);
+				name[sizeof(name)-1] = 0;
+				driver = msi->driver;
+			} else if(virtio_netdev(ent->d_name, name, sizeof(name)))
+				driver = netdev_driver(name, drv, sizeof(drv));
+			else
+				continue;
+			/* only queue vectors. others can not be told apart */
+			role = irq_role(driver, ent->d_name, &q);
+			if(role == ROLE_NONE || role == ROLE_IGNORE) {
+				if(conf.verbose > 1)
+					printf("%s: irq %d %s not a queue\n",
+					       name, irq, ent->d_name);
+				continue;
+			}
+			owner = dev_get(l, name);
+		}
+		if(!owner)
+			continue;
+		dev = owner;
+
+		switch(role) {
+		case ROLE_RX:
+			queue = queue_new(ent->d_name, q, fn);
+			if(queue) {
+				queue->irq = irq;
+				dev->rx++;
+				jl_ins(dev->rxq, queue);
 			}
+			break;
+		case ROLE_TX:
+			queue = queue_new(ent->d_name, q, fn);
+			if(queue) {
+				queue->irq = irq;
+				dev->tx++;
+				jl_ins(dev->txq, queue);
+			}
+			break;
+		case ROLE_TXRX:
+			queue = queue_new(ent->d_name, q, fn);
+			if(queue) {
+				queue->irq = irq;
+				dev->txrx++;
+				jl_ins(dev->txrxq, queue);
+			}
+			break;
+		default:
+			dev->fn = arena_strdup(var.arena, fn); /* pure dev irq */
+			dev->irq = irq;
 		}
 	}
 	closedir(d);
 	
 	if(dev) {
-		char buf[16], afn[256];
+		char buf[CPUMASK_SIZE], afn[256];
 		int fd, rc;
 		
-		snprintf(afn, sizeof(afn), "%s/smp_affinity", fn);
-		fd = open(afn, O_RDONLY);
+		fd = -1;
+		if(snprintf(afn, sizeof(afn), "%s/smp_affinity", fn) < (int)sizeof(afn))
+			fd = open(afn, O_RDONLY);
 		if(fd != -1) {
 			rc = read(fd, buf, sizeof(buf)-1);
 			if(rc > 1) {
 				buf[--rc] = 0;
 				if(queue)
-					queue->old_affinity = strdup(buf);
+					queue->old_affinity = arena_strdup(var.arena, buf);
 				else
-					dev->old_affinity = strdup(buf);
+					dev->old_affinity = arena_strdup(var.arena, buf);
 			}
 			close(fd);
 		} else {
@@ -1021,6 +1525,13 @@ int scan(struct jlhead *l, const struct dirent *ent, const char *base)
 					"Failed to read %s\n", afn);
 			return -1;
 		}
+		if(queue) {
+			queue->effective = irq_mask_read(fn, "effective_affinity");
+			queue->managed = irq_debug_managed(irq);
+		} else {
+			dev->effective = irq_mask_read(fn, "effective_affinity");
+			dev->managed = irq_debug_managed(irq);
+		}
 	}
   return 0;
 }
@@ -1062,7 +1573,7 @@ static int cpu_nodemap()
 	struct dirent *ent;
 	int fd, n, i;
 	struct memnode *memnode;
-	char fn[512], buf[64];
+	char fn[512], buf[CPULIST_SIZE];
 	struct jlhead *intervals, *cpus;
 	char *interval;
 	int first,last;
@@ -1105,7 +1616,7 @@ static int cpu_nodemap()
 
 		memnode = memnode_get(atoi(ent->d_name+4));
 		
-		n = read(fd, buf, sizeof(buf));
+		n = read(fd, buf, sizeof(buf)-1);
 		if(n > 0) {
 			char *tp;
 			buf[n] = 0;
@@ -1136,6 +1647,24 @@ static int cpu_nodemap()
 }	
 
 
+/*
+ * single queue ports at or below this speed (Mb/s) are management ports.
+ * A multiqueue 1G NIC carries traffic and is spread like any other, and
+ * a link that is down at boot is not known to be slow.
+ */
+#define MGMT_SPEED 1000
+
+static int dev_slow(const struct dev *dev)
+{
+	return dev->single && dev->speed > 0 && dev->speed <= MGMT_SPEED;
+}
+
+/* links that get no share of --strategy speed */
+static int dev_parked(const struct dev *dev)
+{
+	return dev->down || dev_slow(dev);
+}
+
 int set_heuristics(struct jlhead *l)
 {
 	struct dev *dev;
@@ -1164,11 +1693,12 @@ int set_heuristics(struct jlhead *l)
 	if(!conf.heuristics) return 0;
 
 	if(exists_mq) {
-		printf("Heuristic:"
-		       " memory node distribution enabled.\n");
+		if(!conf.json && !conf.verify && !conf.promfile)
+			printf("Heuristic:"
+			       " memory node distribution enabled.\n");
 		conf.memnode_dist = 1;
 	}
-	
+
 	/* turn on RPS if we have atleast one multiq interface or
 	   we only have one interface */
 	if(exists_mq || (l->len == 1))
@@ -1212,6 +1742,16 @@ int set_heuristics(struct jlhead *l)
 		if(!dev->single) {
 			if((dev->txrx > 1) || (dev->tx > 1))
 				dev->use_xps = 1;
+			/* virtio-net queues come in input/output pairs served
+			   by the same vCPU */
+			if(!strcmp(dev->driver, "virtio_net") && dev->rx && dev->tx) {
+				if(conf.verbose)
+					printf("Heuristic:"
+					       " tx with rx queue pairs "
+					       "for virtio device %s.\n",
+					       dev->name);
+				dev->pair_tx = 1;
+			}
 			if((dev->txrx <= 1) && 
 			   (dev->rx < var.nr_use_cpu) && 
 			   (conf.num_mq > 1) && 
@@ -1266,50 +1806,13 @@ int ins_comma_list(struct jlhead *l, char *ifnames)
 	for(p=ifnames;p&&*p;) {
 		end = strchr(p, ',');
 		if(end) *end = 0;
-		jl_ins(l, strdup(p));
+		jl_ins(l, arena_strdup(var.arena, p));
 		p = end;
 		if(p) p++;
 	}
 	return 0;
 }
 
-const char *demask(const char *s)
-{
-	unsigned long long n;
-	long long i;
-	size_t mlen=0;
-	char buf[8], *out, *p;
-	struct jlhead *l;
-	l = jl_new();
-	
-	if(!s) return "?";
-	if(*s == '?') return s;
-	
-	n = strtoull(s, NULL, 16);
-	
-	for(i=0;i<MAXCPU;i++)
-	  if(n & ((unsigned long long)1<<i)) {
-			snprintf(buf, sizeof(buf), "%lld", i);
-			jl_append(l, strdup(buf));
-		}
-	
-	jl_foreach(l, p)
-		mlen += (strlen(p)+1);
-
-	out = malloc(mlen+1);
-	*out = 0;
-
-	jl_foreach(l, p) {
-		strcat(out, p);
-		if(jl_next(p))
-			strcat(out, ",");
-	}
-	if(l->len == 0)
-		out = "na";
-	
-	return out;
-}
-
 	/*
 	  Receive Packet Steering (RPS) support:
 	  Anyway, current sysfs RPS interface exposes
@@ -1339,7 +1842,7 @@ static int scan_rps()
 	struct dev *dev;
 	struct queue *queue;
 	int n, fd, i;
-	char fn[256], buf[64];
+	char fn[256], buf[CPUMASK_SIZE];
 	
 	jl_foreach(conf.devices, dev) {
 		for(i=0;i<MAX(1, MAX(dev->rx, dev->txrx));i++) {
@@ -1359,7 +1862,7 @@ static int scan_rps()
 						  i, fn);
 				if(queue) {
 					dev->rps++;
-					queue->old_affinity = strdup(buf);
+					queue->old_affinity = arena_strdup(var.arena, buf);
 					jl_ins(dev->rpsq, queue);
 				}
 				
@@ -1370,17 +1873,92 @@ static int scan_rps()
 	return 0;
 }
 
-static int scan_xps()
+static struct dev *dev_find(const char *name)
 {
 	struct dev *dev;
-	struct queue *queue;
-	int n, fd, i;
-	char fn[256], buf[64];
-	
-	jl_foreach(conf.devices, dev) {
-		for(i=0;i<MAX(1, MAX(dev->tx, dev->txrx));i++) {
-			snprintf(fn, sizeof(fn),
-				 "%s/class/net/%s/queues/tx-%d/xps_cpus",
+
+	jl_foreach(conf.devices, dev)
+		if(!strcmp(dev->name, name))
+			return dev;
+	return NULL;
+}
+
+/*
+ * Bonding and team masters. Slaves of a master carry the same traffic
+ * and are placed as one group. Bonds list their slaves in bonding/slaves,
+ * other masters are recognized by two or more lower_* links. Bridges
+ * also have lower_* links but their ports are independent.
+ */
+static int scan_groups()
+{
+	DIR *d, *md;
+	struct dirent *ent, *ment;
+	struct dev *dev, *lower[64];
+	char fn[512], buf[1024], *p, *name;
+	struct stat statbuf;
+	int fd, n, i, nlower;
+
+	snprintf(fn, sizeof(fn), "%s/class/net", conf.sysdir);
+	d = opendir(fn);
+	if(!d) return -1;
+
+	while((ent = readdir(d))) {
+		if(ent->d_name[0] == '.')
+			continue;
+		nlower = 0;
+
+		snprintf(fn, sizeof(fn), "%s/class/net/%s/bonding/slaves",
+			 conf.sysdir, ent->d_name);
+		fd = open(fn, O_RDONLY);
+		if(fd != -1) {
+			n = read(fd, buf, sizeof(buf)-1);
+			close(fd);
+			buf[n > 0 ? n : 0] = 0;
+			for(name=strtok_r(buf, " \n", &p);name;name=strtok_r(NULL, " \n", &p))
+				if( (dev = dev_find(name)) && nlower < 64)
+					lower[nlower++] = dev;
+		} else {
+			snprintf(fn, sizeof(fn), "%s/class/net/%s/bridge",
+				 conf.sysdir, ent->d_name);
+			if(!stat(fn, &statbuf))
+				continue;
+			snprintf(fn, sizeof(fn), "%s/class/net/%s",
+				 conf.sysdir, ent->d_name);
+			md = opendir(fn);
+			if(!md) continue;
+			while((ment = readdir(md))) {
+				if(strncmp(ment->d_name, "lower_", 6))
+					continue;
+				if( (dev = dev_find(ment->d_name+6)) && nlower < 64)
+					lower[nlower++] = dev;
+			}
+			closedir(md);
+		}
+
+		if(nlower < 2)
+			continue;
+		name = arena_strdup(var.arena, ent->d_name);
+		for(i=0;i<nlower;i++) {
+			lower[i]->group = name;
+			if(conf.verbose > 1)
+				printf("%s in group %s\n", lower[i]->name, name);
+		}
+	}
+	closedir(d);
+	return 0;
+}
+
+static int scan_xps()
+{
+	struct dev *dev;
+	struct queue *queue;
+	int n, fd, i;
+	char fn[256], buf[CPUMASK_SIZE];
+	
+	jl_foreach(conf.devices, dev) {
+		for(i=0;i<MAX(1, MAX(dev->tx, dev->txrx));i++) {
+			snprintf(fn, sizeof(fn),
+				 "%s/class/net/%s/queues/tx-%d/xps_cpus",
 				 conf.sysdir,
 				 dev->name,
 				 i);
@@ -1388,31 +1966,1988 @@ static int scan_xps()
 			fd = open(fn, O_RDONLY);
 			if(fd == -1)
 				continue;
-			n = read(fd, buf, sizeof(buf)-1);
-			if(n>1) {
-				buf[--n] = 0;
-				queue = queue_new(dev->name,
-						  i, fn);
-				if(queue) {
-					dev->xps++;
-					queue->old_affinity = strdup(buf);
-					jl_ins(dev->xpsq, queue);
-				}
-				
+			n = read(fd, buf, sizeof(buf)-1);
+			if(n>1) {
+				buf[--n] = 0;
+				queue = queue_new(dev->name,
+						  i, fn);
+				if(queue) {
+					dev->xps++;
+					queue->old_affinity = arena_strdup(var.arena, buf);
+					jl_ins(dev->xpsq, queue);
+				}
+				
+			}
+			close(fd);
+		}
+	}
+	return 0;
+}
+
+/* square root by Newton iteration. avoids pulling in libm */
+static double sqroot(double x)
+{
+	double r = x;
+	int i;
+
+	if(x <= 0) return 0;
+	for(i=0;i<32;i++)
+		r = (r + x/r) / 2;
+	return r;
+}
+
+/* first cpu of the SMT siblings of cpu. identifies the physical core */
+static int cpu_core(int cpu)
+{
+	struct cpumask mask;
+	int i;
+
+	if(cpu_listattr(cpu, "topology/thread_siblings_list", &mask))
+		return cpu;
+	for(i=0;i<MAXCPU;i++)
+		if(cpumask_isset(&mask, i))
+			return i;
+	return cpu;
+}
+
+static int mask_nodes(const struct cpumask *mask)
+{
+	struct memnode *node;
+	int i, nodes = 0;
+
+	jl_foreach(conf.memnodes, node) {
+		for(i=0;i<MAXCPU;i++)
+			if(node->cpu[i] && cpumask_isset(mask, i)) {
+				nodes++;
+				break;
+			}
+	}
+	return nodes;
+}
+
+static int mask_on_node(const struct cpumask *mask, int n)
+{
+	struct memnode *node;
+	int i;
+
+	jl_foreach(conf.memnodes, node) {
+		if(node->n != n)
+			continue;
+		for(i=0;i<MAXCPU;i++)
+			if(node->cpu[i] && cpumask_isset(mask, i))
+				return 1;
+		return 0;
+	}
+	return 1; /* unknown node */
+}
+
+struct report {
+	int load[MAXCPU]; /* irq queues per cpu */
+	int core_rx[MAXCPU]; /* rx queues per core */
+	struct cpumask core_threads[MAXCPU]; /* threads of core with rx queues */
+	int core[MAXCPU];
+	int offnode, rpscross;
+};
+
+static void report_irq(struct report *r, const struct dev *dev,
+		       const char *name, const char *newmask, int rx)
+{
+	struct cpumask mask;
+	int i, cpu = -1;
+
+	if(!newmask || cpumask_parse(&mask, newmask))
+		return;
+	for(i=0;i<var.nr_cpu;i++)
+		if(cpumask_isset(&mask, i)) {
+			r->load[i]++;
+			cpu = i;
+		}
+	if(var.multinode && dev->numa_node >= 0 &&
+	   !mask_on_node(&mask, dev->numa_node)) {
+		r->offnode++;
+		if(conf.verbose)
+			printf(" off-node: %s not on node %d\n",
+			       name, dev->numa_node);
+	}
+	/* only pinned queues can collide on a core */
+	if(rx && cpu >= 0 && cpumask_weight(&mask) == 1) {
+		r->core_rx[r->core[cpu]]++;
+		cpumask_set(&r->core_threads[r->core[cpu]], cpu);
+	}
+}
+
+static void report_rps(struct report *r, const struct queue *q)
+{
+	struct cpumask mask;
+
+	if(!q->new_affinity || cpumask_parse(&mask, q->new_affinity))
+		return;
+	if(mask_nodes(&mask) > 1) {
+		r->rpscross++;
+		if(conf.verbose)
+			printf(" rps crossing nodes: %s rx-%d\n", q->name, q->n);
+	}
+}
+
+/*
+ * summarize the placement just computed (--report)
+ */
+static void report(struct jlhead *l)
+{
+	struct report *r;
+	struct dev *dev;
+	struct queue *q;
+	int i, ncpu = 0, min = -1, max = 0, sum = 0;
+	int smtcores = 0, smtqueues = 0;
+	double avg, var_sum = 0;
+
+	r = arena_alloc(var.arena, sizeof(struct report));
+	if(!r) return;
+	memset(r, 0, sizeof(struct report));
+	for(i=0;i<var.nr_cpu;i++)
+		r->core[i] = cpu_core(i);
+
+	if(!conf.json)
+		printf("Report:\n");
+	jl_foreach(l, dev) {
+		if(dev->single) {
+			report_irq(r, dev, dev->name, dev->new_affinity, 1);
+		} else {
+			jl_foreach(dev->rxq, q)
+				report_irq(r, dev, q->name, q->new_affinity, 1);
+			jl_foreach(dev->txq, q)
+				report_irq(r, dev, q->name, q->new_affinity, 0);
+			jl_foreach(dev->txrxq, q)
+				report_irq(r, dev, q->name, q->new_affinity, 1);
+		}
+		jl_foreach(dev->rpsq, q)
+			report_rps(r, q);
+	}
+
+	/* CPUs available for placement and any CPU that got a queue anyway */
+	for(i=0;i<var.nr_cpu;i++) {
+		if(!r->load[i] &&
+		   (i < var.cpu_offset || i >= var.cpu_offset + var.nr_use_cpu))
+			continue;
+		if(conf.verbose)
+			printf(" cpu %d: %d\n", i, r->load[i]);
+		ncpu++;
+		sum += r->load[i];
+		if(min == -1 || r->load[i] < min) min = r->load[i];
+		if(r->load[i] > max) max = r->load[i];
+	}
+	avg = ncpu ? (double)sum / ncpu : 0;
+	for(i=0;i<var.nr_cpu;i++) {
+		if(!r->load[i] &&
+		   (i < var.cpu_offset || i >= var.cpu_offset + var.nr_use_cpu))
+			continue;
+		var_sum += (r->load[i] - avg) * (r->load[i] - avg);
+	}
+
+	for(i=0;i<var.nr_cpu;i++) {
+		if(cpumask_weight(&r->core_threads[i]) > 1) {
+			smtcores++;
+			smtqueues += r->core_rx[i];
+			if(conf.verbose)
+				printf(" smt: %d rx queues on core of cpu %d\n",
+				       r->core_rx[i], i);
+		}
+	}
+
+	if(conf.json) {
+		printf("{\"type\":\"report\",\"cpus\":%d,\"min\":%d,\"max\":%d"
+		       ",\"avg\":%.2f,\"stddev\":%.2f",
+		       ncpu, min < 0 ? 0 : min, max, avg,
+		       sqroot(ncpu ? var_sum / ncpu : 0));
+		printf(",\"offnode\":%d,\"smt_queues\":%d,\"smt_cores\":%d"
+		       ",\"rps_crossing\":%d}\n",
+		       r->offnode, smtqueues, smtcores, r->rpscross);
+		return;
+	}
+	printf(" queues per cpu: min %d max %d avg %.2f stddev %.2f over %d cpus\n",
+	       min < 0 ? 0 : min, max, avg,
+	       sqroot(ncpu ? var_sum / ncpu : 0), ncpu);
+	printf(" queues off device node: %d\n", r->offnode);
+	printf(" rx queues sharing an smt core: %d on %d cores\n",
+	       smtqueues, smtcores);
+	printf(" rps masks crossing nodes: %d\n", r->rpscross);
+}
+
+enum { PROM_INFO, PROM_TOTAL, PROM_CPU, PROM_FOREIGN, PROM_NR };
+
+static const char *prom_help[PROM_NR][3] = {
+	{ "eth_affinity_queue_info", "gauge",
+	  "Queue with its planned and current CPUs." },
+	{ "eth_affinity_queue_interrupts_total", "counter",
+	  "Interrupts of a queue." },
+	{ "eth_affinity_queue_cpu_interrupts_total", "counter",
+	  "Interrupts of a queue serviced per CPU." },
+	{ "eth_affinity_queue_foreign_interrupts_total", "counter",
+	  "Interrupts of a queue serviced outside its planned CPUs"
+	  " since the first sample." },
+};
+
+/* a sample of the previous textfile. cpu -1 for the foreign counter */
+struct promsample {
+	int irq, cpu;
+	unsigned long long value;
+};
+
+static struct promsample *prom_prev;
+static int prom_nprev;
+
+static int promcmp(const void *i1, const void *i2)
+{
+	const struct promsample *s1=i1, *s2=i2;
+
+	if(s1->irq != s2->irq)
+		return s1->irq - s2->irq;
+	return s1->cpu - s2->cpu;
+}
+
+/* per CPU and foreign counts from the textfile written last time */
+static void prom_read(const char *fn)
+{
+	struct promsample *s;
+	char line[512], *p;
+	int size = 0, cpu;
+	FILE *f;
+
+	f = fopen(fn, "r");
+	if(!f) return;
+	while(fgets(line, sizeof(line), f)) {
+		if(!strncmp(line, prom_help[PROM_CPU][0], strlen(prom_help[PROM_CPU][0])))
+			cpu = 0;
+		else if(!strncmp(line, prom_help[PROM_FOREIGN][0],
+				 strlen(prom_help[PROM_FOREIGN][0])))
+			cpu = -1;
+		else
+			continue;
+		if(prom_nprev == size) {
+			size = size ? size*2 : 256;
+			s = arena_alloc(var.arena, sizeof(struct promsample) * size);
+			if(!s) break;
+			if(prom_nprev)
+				memcpy(s, prom_prev, sizeof(struct promsample) * prom_nprev);
+			prom_prev = s;
+		}
+		s = prom_prev + prom_nprev;
+		if(!(p = strstr(line, "irq=\"")))
+			continue;
+		s->irq = atoi(p+5);
+		s->cpu = cpu;
+		if(cpu == 0) {
+			if(!(p = strstr(line, "cpu=\"")))
+				continue;
+			s->cpu = atoi(p+5);
+		}
+		if(!(p = strrchr(line, '}')))
+			continue;
+		s->value = strtoull(p+1, NULL, 10);
+		prom_nprev++;
+	}
+	fclose(f);
+	qsort(prom_prev, prom_nprev, sizeof(struct promsample), promcmp);
+}
+
+static const struct promsample *prom_sample(int irq, int cpu)
+{
+	struct promsample key;
+
+	if(!prom_nprev)
+		return NULL;
+	key.irq = irq;
+	key.cpu = cpu;
+	return bsearch(&key, prom_prev, prom_nprev, sizeof(struct promsample),
+		       promcmp);
+}
+
+/* planned mask of an irq, the current one if the plan leaves it alone */
+static const char *prom_planned(const struct dev *dev, const struct queue *q)
+{
+	struct plan *e;
+
+	jl_foreach(var.plan, e)
+		if(e->dev == dev && e->q == q && !strcmp(e->type, "irq"))
+			return e->mask;
+	return q ? q->old_affinity : dev->old_affinity;
+}
+
+/*
+ * The foreign counter adds up what arrived outside the planned CPUs
+ * between samples, so it only grows and leaves out what came before the
+ * first sample and before pinning. A per CPU count below the last sample
+ * means the counts were reset, and all of it is new.
+ */
+static unsigned long long prom_foreign(const struct interrupts *in,
+				       const struct irqcount *row, int irq,
+				       const char *planned)
+{
+	const struct promsample *s;
+	struct cpumask mask;
+	unsigned long long foreign, prev;
+	int i;
+
+	s = prom_sample(irq, -1);
+	if(!s)
+		return 0;
+	foreign = s->value;
+	if(cpumask_parse(&mask, planned))
+		return foreign;
+	for(i=0;i<in->ncol;i++) {
+		if(cpumask_isset(&mask, in->cpu[i]))
+			continue;
+		s = prom_sample(irq, in->cpu[i]);
+		prev = s ? s->value : 0;
+		foreign += row->count[i] >= prev ? row->count[i] - prev : row->count[i];
+	}
+	return foreign;
+}
+
+static void prom_queue(FILE *f, const struct interrupts *in, int metric,
+		       const struct dev *dev, const struct queue *q)
+{
+	struct irqcount *row;
+	char cpus[CPULIST_SIZE], curcpus[CPULIST_SIZE], labels[256];
+	const char *name, *planned, *current;
+	const char *metric_name = prom_help[metric][0];
+	int i, irq;
+
+	name = q ? q->name : dev->name;
+	irq = q ? q->irq : dev->irq;
+	current = q ? q->old_affinity : dev->old_affinity;
+	planned = prom_planned(dev, q);
+	row = interrupts_irq(in, irq);
+	if(!row) return;
+
+	snprintf(labels, sizeof(labels), "dev=\"%s\",queue=\"%s\",irq=\"%d\"",
+		 dev->name, name, irq);
+
+	switch(metric) {
+	case PROM_INFO:
+		fprintf(f, "%s{%s,node=\"%d\",assigned=\"%s\",current=\"%s\"} 1\n",
+			metric_name, labels, dev->numa_node,
+			demask(planned, cpus, sizeof(cpus)),
+			demask(current, curcpus, sizeof(curcpus)));
+		break;
+	case PROM_TOTAL:
+		fprintf(f, "%s{%s} %llu\n", metric_name, labels, row->total);
+		break;
+	case PROM_CPU:
+		for(i=0;i<in->ncol;i++)
+			if(row->count[i])
+				fprintf(f, "%s{%s,cpu=\"%d\"} %llu\n",
+					metric_name, labels, in->cpu[i], row->count[i]);
+		break;
+	case PROM_FOREIGN:
+		fprintf(f, "%s{%s} %llu\n", metric_name, labels,
+			prom_foreign(in, row, irq, planned));
+		break;
+	}
+}
+
+/*
+ * node_exporter textfile (--prom). Queues are labelled with the masks of
+ * a dry run plan, so a mask rewritten by someone else shows up as
+ * interrupts on foreign CPUs. Samples of a metric are kept together as
+ * the text format requires. Written to a temporary file and renamed so
+ * the collector never sees a partial file.
+ */
+static int prom_write(const char *fn)
+{
+	struct interrupts in;
+	struct dev *dev;
+	struct queue *q;
+	char path[256], tmp[512];
+	FILE *f;
+	int metric;
+
+	snprintf(path, sizeof(path), "%s/interrupts", conf.procdir);
+	if(interrupts_read(&in, path, var.arena)) {
+		if(!conf.silent)
+			fprintf(stderr, "Failed to read %s\n", path);
+		return -1;
+	}
+	prom_read(fn);
+
+	snprintf(tmp, sizeof(tmp), "%s.%d", fn, getpid());
+	f = fopen(tmp, "w");
+	if(!f) {
+		if(!conf.silent)
+			fprintf(stderr, "Failed to open '%s'\n", tmp);
+		return -1;
+	}
+
+	for(metric=0;metric<PROM_NR;metric++) {
+		fprintf(f, "# HELP %s %s\n", prom_help[metric][0], prom_help[metric][2]);
+		fprintf(f, "# TYPE %s %s\n", prom_help[metric][0], prom_help[metric][1]);
+		jl_foreach(conf.devices, dev) {
+			if(dev->single) {
+				prom_queue(f, &in, metric, dev, NULL);
+				continue;
+			}
+			jl_foreach(dev->rxq, q)
+				prom_queue(f, &in, metric, dev, q);
+			jl_foreach(dev->txq, q)
+				prom_queue(f, &in, metric, dev, q);
+			jl_foreach(dev->txrxq, q)
+				prom_queue(f, &in, metric, dev, q);
+		}
+	}
+
+	if(fclose(f) || rename(tmp, fn)) {
+		if(!conf.silent)
+			fprintf(stderr, "Failed to write '%s'\n", fn);
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+struct rate {
+	struct dev *dev;
+	struct queue *q; /* NULL for the irq of a single queue device */
+	double rate;
+	int cpu; /* cpu servicing most of the interrupts */
+};
+
+static int ratecmp(const void *i1, const void *i2)
+{
+	const struct rate *r1=i1, *r2=i2;
+
+	if(r1->rate == r2->rate)
+		return 0;
+	return r1->rate < r2->rate ? 1 : -1;
+}
+
+/* increase of a row on one cpu. columns are matched by cpu number, as
+   cpus can go offline between samples and the two files can differ */
+static unsigned long long delta(const struct interrupts *in0, const struct irqcount *r0,
+				const struct interrupts *in1, const struct irqcount *r1,
+				int cpu)
+{
+	int c0, c1;
+
+	if(!r0 || !r1)
+		return 0;
+	c0 = interrupts_col(in0, cpu);
+	c1 = interrupts_col(in1, cpu);
+	if(c0 < 0 || c1 < 0 || r1->count[c1] < r0->count[c0])
+		return 0;
+	return r1->count[c1] - r0->count[c0];
+}
+
+static int profile_write(const char *fn, struct jlhead *rates, int seconds)
+{
+	struct rate *r;
+	char tmp[512];
+	FILE *f;
+
+	snprintf(tmp, sizeof(tmp), "%s.%d", fn, getpid());
+	f = fopen(tmp, "w");
+	if(!f) {
+		if(!conf.silent)
+			fprintf(stderr, "Failed to open '%s'\n", tmp);
+		return -1;
+	}
+	fprintf(f, "# eth-affinity profile. interrupts/s over %d s\n", seconds);
+	jl_foreach(rates, r)
+		fprintf(f, "%s %.1f\n", r->q ? r->q->name : r->dev->name, r->rate);
+	if(fclose(f) || rename(tmp, fn)) {
+		if(!conf.silent)
+			fprintf(stderr, "Failed to write '%s'\n", fn);
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+static void measure_queue(struct jlhead *rates, double *cpurate,
+			  const struct interrupts *in0, const struct interrupts *in1,
+			  int seconds, struct dev *dev, struct queue *q)
+{
+	struct irqcount *r0, *r1;
+	struct rate *r;
+	unsigned long long d, top = 0;
+	int i, irq;
+
+	irq = q ? q->irq : dev->irq;
+	r0 = interrupts_irq(in0, irq);
+	r1 = interrupts_irq(in1, irq);
+	if(!r0 || !r1) return;
+
+	r = arena_alloc(var.arena, sizeof(struct rate));
+	if(!r) return;
+	r->dev = dev;
+	r->q = q;
+	r->rate = 0;
+	r->cpu = -1;
+	for(i=0;i<in1->ncol;i++) {
+		d = delta(in0, r0, in1, r1, in1->cpu[i]);
+		if(!d) continue;
+		r->rate += (double)d / seconds;
+		if(in1->cpu[i] < MAXCPU)
+			cpurate[in1->cpu[i]] += (double)d / seconds;
+		if(d > top) {
+			top = d;
+			r->cpu = in1->cpu[i];
+		}
+	}
+	jl_ins(rates, r);
+}
+
+/*
+ * Sample /proc/interrupts and /proc/softirqs over a window (--measure)
+ * and show queue interrupt rates, hottest first, and per CPU softirq rates.
+ */
+static int measure(int seconds)
+{
+	struct interrupts in0, in1, soft0, soft1;
+	struct irqcount *rx0, *rx1, *tx0, *tx1;
+	struct jlhead *rates;
+	struct rate *r;
+	struct dev *dev;
+	struct queue *q;
+	char irqfn[256], softfn[256];
+	double *cpurate, max = 0, sum = 0;
+	int i, ncpu = 0, maxcpu = -1, havesoft;
+
+	snprintf(irqfn, sizeof(irqfn), "%s/interrupts", conf.procdir);
+	snprintf(softfn, sizeof(softfn), "%s/softirqs", conf.procdir);
+
+	if(interrupts_read(&in0, irqfn, var.arena)) {
+		if(!conf.silent)
+			fprintf(stderr, "Failed to read %s\n", irqfn);
+		return -1;
+	}
+	havesoft = !interrupts_read(&soft0, softfn, var.arena);
+	sleep(seconds);
+	if(interrupts_read(&in1, irqfn, var.arena)) {
+		if(!conf.silent)
+			fprintf(stderr, "Failed to read %s\n", irqfn);
+		return -1;
+	}
+	if(havesoft)
+		havesoft = !interrupts_read(&soft1, softfn, var.arena);
+
+	cpurate = arena_alloc(var.arena, sizeof(double) * MAXCPU);
+	if(!cpurate) return -1;
+	memset(cpurate, 0, sizeof(double) * MAXCPU);
+
+	rates = jl_new();
+	jl_sort(rates, ratecmp);
+	jl_foreach(conf.devices, dev) {
+		if(dev->single) {
+			measure_queue(rates, cpurate, &in0, &in1, seconds, dev, NULL);
+			continue;
+		}
+		jl_foreach(dev->rxq, q)
+			measure_queue(rates, cpurate, &in0, &in1, seconds, dev, q);
+		jl_foreach(dev->txq, q)
+			measure_queue(rates, cpurate, &in0, &in1, seconds, dev, q);
+		jl_foreach(dev->txrxq, q)
+			measure_queue(rates, cpurate, &in0, &in1, seconds, dev, q);
+	}
+
+	if(!conf.json)
+		printf("Queue interrupt rates over %d s:\n", seconds);
+	jl_foreach(rates, r) {
+		const char *name = r->q ? r->q->name : r->dev->name;
+		int irq = r->q ? r->q->irq : r->dev->irq;
+
+		if(conf.json) {
+			printf("{\"type\":\"queue_rate\"");
+			json_str("dev", r->dev->name);
+			json_str("name", name);
+			printf(",\"irq\":%d,\"rate\":%.1f,\"cpu\":%d}\n",
+			       irq, r->rate, r->cpu);
+		} else if(r->cpu >= 0)
+			printf(" %s irq %d: %.1f/s mostly on cpu %d\n",
+			       name, irq, r->rate, r->cpu);
+		else
+			printf(" %s irq %d: idle\n", name, irq);
+	}
+
+	rx0 = havesoft ? interrupts_label(&soft0, "NET_RX") : NULL;
+	rx1 = havesoft ? interrupts_label(&soft1, "NET_RX") : NULL;
+	tx0 = havesoft ? interrupts_label(&soft0, "NET_TX") : NULL;
+	tx1 = havesoft ? interrupts_label(&soft1, "NET_TX") : NULL;
+
+	if(conf.recordfile && profile_write(conf.recordfile, rates, seconds))
+		return -1;
+
+	if(!conf.json)
+		printf("CPU rates:\n");
+	for(i=0;i<in1.ncol;i++) {
+		int cpu = in1.cpu[i];
+		double qrate = cpu < MAXCPU ? cpurate[cpu] : 0;
+		double rx = 0, tx = 0;
+
+		if(havesoft) {
+			rx = (double)delta(&soft0, rx0, &soft1, rx1, cpu) / seconds;
+			tx = (double)delta(&soft0, tx0, &soft1, tx1, cpu) / seconds;
+		}
+		if(conf.json)
+			printf("{\"type\":\"cpu_rate\",\"cpu\":%d,\"irq\":%.1f"
+			       ",\"net_rx\":%.1f,\"net_tx\":%.1f}\n",
+			       cpu, qrate, rx, tx);
+		else if(qrate || rx || tx || conf.verbose)
+			printf(" cpu %d: queue irq %.1f/s NET_RX %.1f/s NET_TX %.1f/s\n",
+			       cpu, qrate, rx, tx);
+		ncpu++;
+		sum += qrate;
+		if(qrate > max) {
+			max = qrate;
+			maxcpu = cpu;
+		}
+	}
+
+	/* hottest CPU against the mean, 1.0 is perfectly even */
+	if(conf.json)
+		printf("{\"type\":\"imbalance\",\"ratio\":%.2f,\"cpu\":%d}\n",
+		       sum ? max / (sum / ncpu) : 0, maxcpu);
+	else if(sum)
+		printf("Imbalance: %.2f (cpu %d at %.1f/s, mean %.1f/s over %d cpus)\n",
+		       max / (sum / ncpu), maxcpu, max, sum / ncpu, ncpu);
+	else
+		printf("Imbalance: no queue interrupts\n");
+	return 0;
+}
+
+/*
+ * Queue weights (--profile). One "queue-name rate" pair per line as
+ * written by --record. Queues are matched by name since irq numbers
+ * change between boots.
+ */
+static int profile_read(const char *fn)
+{
+	FILE *f;
+	char line[256], name[64], dname[16], *p;
+	double rate;
+	struct dev *dev;
+	struct queue *q;
+	int found;
+
+	f = fopen(fn, "r");
+	if(!f) {
+		if(!conf.silent)
+			fprintf(stderr, "Failed to open '%s'\n", fn);
+		return -1;
+	}
+	while(fgets(line, sizeof(line), f)) {
+		if(line[0] == '#')
+			continue;
+		if(sscanf(line, "%63s %lf", name, &rate) != 2)
+			continue;
+		strncpy(dname, name, sizeof(dname)-1);
+		dname[sizeof(dname)-1] = 0;
+		if( (p = strchr(dname, '-')) ) *p = 0;
+
+		found = 0;
+		jl_foreach(conf.devices, dev) {
+			if(strcmp(dev->name, dname))
+				continue;
+			if(dev->single && !strcmp(dev->name, name)) {
+				dev->weight = rate;
+				found = 1;
+			}
+			jl_foreach(dev->rxq, q)
+				if(!strcmp(q->name, name)) { q->weight = rate; found = 1; }
+			jl_foreach(dev->txq, q)
+				if(!strcmp(q->name, name)) { q->weight = rate; found = 1; }
+			jl_foreach(dev->txrxq, q)
+				if(!strcmp(q->name, name)) { q->weight = rate; found = 1; }
+		}
+		if(!found && conf.verbose)
+			printf("Profile: no queue %s\n", name);
+	}
+	fclose(f);
+	return 0;
+}
+
+/* CPUs the planner may use for a device: its node, within the usable range */
+static void dev_cpus(const struct dev *dev, struct cpumask *mask)
+{
+	struct memnode *node;
+	int i, first, last;
+
+	dev_range(dev, &first, &last);
+
+	cpumask_zero(mask);
+	jl_foreach(conf.memnodes, node) {
+		if(node->n != dev->numa_node)
+			continue;
+		for(i=first;i<last;i++)
+			if(node->cpu[i])
+				cpumask_set(mask, i);
+	}
+	if(cpumask_weight(mask))
+		return;
+	for(i=first;i<last;i++)
+		cpumask_set(mask, i);
+}
+
+/*
+ * Managed irqs stay on the CPUs the kernel chose. They are known up front
+ * from the irq debugfs only; nothing is written to find them. Any other
+ * managed irq refuses its write in plan_apply() and is marked there.
+ * var.avoid collects the CPUs of those known up front.
+ */
+static void managed_check(const char *old, const char *effective, int managed)
+{
+	struct cpumask mask;
+
+	if(!managed || !old)
+		return;
+	var.nmanaged++;
+	if(!cpumask_parse(&mask, effective ? effective : old))
+		cpumask_or(&var.avoid, &mask);
+}
+
+static int scan_managed(struct jlhead *devices)
+{
+	struct dev *dev;
+	struct queue *q;
+	char cpus[CPULIST_SIZE], buf[CPUMASK_SIZE];
+
+	cpumask_zero(&var.avoid);
+	var.nmanaged = 0;
+	jl_foreach(devices, dev) {
+		if(dev->single)
+			managed_check(dev->old_affinity, dev->effective, dev->managed);
+		jl_foreach(dev->rxq, q)
+			managed_check(q->old_affinity, q->effective, q->managed);
+		jl_foreach(dev->txq, q)
+			managed_check(q->old_affinity, q->effective, q->managed);
+		jl_foreach(dev->txrxq, q)
+			managed_check(q->old_affinity, q->effective, q->managed);
+	}
+	if(conf.verbose && cpumask_weight(&var.avoid))
+		printf("Heuristic: keeping other irqs off CPU %s"
+		       " used by managed irqs.\n",
+		       demask(cpumask_hex(&var.avoid, buf, sizeof(buf)),
+			      cpus, sizeof(cpus)));
+	if(conf.verbose && cpumask_weight(&var.dedicated))
+		printf("Heuristic: keeping other irqs and rps off CPU %s"
+		       " dedicated to reserved queues.\n",
+		       demask(cpumask_hex(&var.dedicated, buf, sizeof(buf)),
+			      cpus, sizeof(cpus)));
+	cpumask_or(&var.avoid, &var.dedicated);
+	return 0;
+}
+
+/*
+ * --reserve-queues dev:queues:cpus, e.g. eth2:8-11:20-23, for AF_XDP or
+ * busy polling consumers on dedicated cores. The n-th queue listed goes
+ * to the n-th CPU listed, tx-N with rx-N. No other irq is placed on the
+ * CPUs and they are left out of rps masks.
+ */
+struct reservation {
+	char *dev;
+	struct cpumask queues, cpus;
+};
+
+static int reservation_add(const char *spec)
+{
+	struct reservation *r;
+	char *p, *q;
+
+	r = arena_alloc(var.arena, sizeof(struct reservation));
+	if(!r) return -1;
+	r->dev = arena_strdup(var.arena, spec);
+	p = strchr(r->dev, ':');
+	if(!p) return -1;
+	*p++ = 0;
+	q = strchr(p, ':');
+	if(!q) return -1;
+	*q++ = 0;
+	if(!*r->dev || cpumask_parselist(&r->queues, p) || cpumask_parselist(&r->cpus, q))
+		return -1;
+	if(!cpumask_weight(&r->queues) || !cpumask_weight(&r->cpus))
+		return -1;
+	cpumask_or(&var.dedicated, &r->cpus);
+	return jl_append(conf.reservations, r);
+}
+
+static int reserve_preassign(struct jlhead *devices)
+{
+	struct reservation *r;
+	struct dev *dev;
+	struct queue *q;
+	int cpus[MAXCPU], ncpu, n, k, c;
+
+	jl_foreach(conf.reservations, r) {
+		dev = dev_find(r->dev);
+		if(!dev) {
+			if(!conf.silent)
+				fprintf(stderr, "Reserved queues: no device %s\n", r->dev);
+			continue;
+		}
+		ncpu = 0;
+		for(c=0;c<MAXCPU;c++)
+			if(cpumask_isset(&r->cpus, c))
+				cpus[ncpu++] = c;
+		for(n=0,k=0;n<MAXCPU;n++) {
+			if(!cpumask_isset(&r->queues, n))
+				continue;
+			c = cpus[k++ % ncpu];
+			if(dev->single && n == 0) {
+				dev->assigned_cpu = c;
+				dev->reason = "reserved";
+				dev->reserved = 1;
+				continue;
+			}
+			q = queue_n(dev->rx ? dev->rxq : dev->txrxq, n);
+			if(!q) {
+				if(!conf.silent)
+					fprintf(stderr, "Reserved queues: %s has no queue %d\n",
+						dev->name, n);
+				continue;
+			}
+			q->assigned_cpu = c;
+			q->reason = "reserved";
+			q->reserved = 1;
+			if( (q = queue_n(dev->txq, n)) ) {
+				q->assigned_cpu = c;
+				q->reason = "reserved";
+				q->reserved = 1;
+			}
+		}
+	}
+	return 0;
+}
+
+/* first CPU the kernel runs a managed irq on, -1 if unknown */
+static int managed_cpu(const char *old, const char *effective)
+{
+	struct cpumask mask;
+	int cpu;
+
+	if(cpumask_parse(&mask, effective ? effective : old))
+		return -1;
+	for(cpu=0;cpu<MAXCPU;cpu++)
+		if(cpumask_isset(&mask, cpu))
+			return cpu;
+	return -1;
+}
+
+/*
+ * least loaded CPU of the device's node, outside var.avoid if possible.
+ * CPUs of managed irqs are still better than dedicated ones.
+ */
+static int avoid_cpu(const struct dev *dev, int *load)
+{
+	struct cpumask mask;
+	int c, cpu = -1, a, b;
+
+	dev_cpus(dev, &mask);
+	for(c=0;c<var.nr_cpu;c++) {
+		if(!cpumask_isset(&mask, c))
+			continue;
+		if(cpu < 0) {
+			cpu = c;
+			continue;
+		}
+		a = cpumask_isset(&var.avoid, c) + cpumask_isset(&var.dedicated, c);
+		b = cpumask_isset(&var.avoid, cpu) + cpumask_isset(&var.dedicated, cpu);
+		if(a < b || (a == b && load[c] < load[cpu]))
+			cpu = c;
+	}
+	if(cpu >= 0)
+		load[cpu]++;
+	return cpu;
+}
+
+static void managed_place(const struct dev *dev, int *cpu, const char **reason,
+			  int managed, int reserved, const char *old,
+			  const char *effective, int *load)
+{
+	if(reserved)
+		return;
+	if(managed) {
+		*cpu = managed_cpu(old, effective);
+		*reason = "managed";
+		return;
+	}
+	if(*cpu >= 0 && !cpumask_isset(&var.avoid, *cpu))
+		return;
+	*cpu = avoid_cpu(dev, load);
+	*reason = "avoid cpus";
+}
+
+/*
+ * With managed irqs or reserved queues present: pin managed irqs where
+ * the kernel has them, so xps follows, and move the other irqs the
+ * strategy placed on avoided CPUs, or left for round-robin, to the least
+ * loaded CPUs elsewhere. tx-N follows rx-N.
+ */
+static int managed_preassign(struct jlhead *devices)
+{
+	struct dev *dev;
+	struct queue *q, *tq;
+	int *load, i;
+
+	if(!cpumask_weight(&var.avoid))
+		return 0;
+	load = arena_alloc(var.arena, sizeof(int) * MAXCPU);
+	if(!load) return -1;
+	memset(load, 0, sizeof(int) * MAXCPU);
+
+	jl_foreach(devices, dev) {
+		if(dev->single && dev->assigned_cpu >= 0)
+			load[dev->assigned_cpu]++;
+		jl_foreach(dev->rx ? dev->rxq : dev->txrxq, q)
+			if(q->assigned_cpu >= 0 && !cpumask_isset(&var.avoid, q->assigned_cpu))
+				load[q->assigned_cpu]++;
+	}
+
+	jl_foreach(devices, dev) {
+		if(dev->single) {
+			managed_place(dev, &dev->assigned_cpu, &dev->reason,
+				      dev->managed, dev->reserved, dev->old_affinity,
+				      dev->effective, load);
+			continue;
+		}
+		jl_foreach(dev->rxq, q)
+			managed_place(dev, &q->assigned_cpu, &q->reason,
+				      q->managed, q->reserved, q->old_affinity,
+				      q->effective, load);
+		jl_foreach(dev->txrxq, q)
+			managed_place(dev, &q->assigned_cpu, &q->reason,
+				      q->managed, q->reserved, q->old_affinity,
+				      q->effective, load);
+		i = 0;
+		jl_foreach(dev->txq, tq) {
+			q = jl_at(dev->rxq, i++);
+			if(!tq->managed && !tq->reserved && q &&
+			   (tq->assigned_cpu < 0 || cpumask_isset(&var.avoid, tq->assigned_cpu))) {
+				tq->assigned_cpu = q->assigned_cpu;
+				tq->reason = q->reason;
+				continue;
+			}
+			managed_place(dev, &tq->assigned_cpu, &tq->reason,
+				      tq->managed, tq->reserved, tq->old_affinity,
+				      tq->effective, load);
+		}
+	}
+	return 0;
+}
+
+/* queue i of dev carrying rx, pinned together with its tx-N */
+static void group_pin(struct dev *dev, int i, int cpu)
+{
+	struct queue *q;
+
+	if(dev->single) {
+		dev->assigned_cpu = cpu;
+		dev->reason = "group";
+		return;
+	}
+	q = jl_at(dev->rx ? dev->rxq : dev->txrxq, i);
+	if(q) {
+		q->assigned_cpu = cpu;
+		q->reason = "group";
+	}
+	q = jl_at(dev->txq, i);
+	if(q) {
+		q->assigned_cpu = cpu;
+		q->reason = "group";
+	}
+}
+
+/* add the CPUs the strategy gave the irqs of dev to mask */
+static void group_strategy_cpus(const struct dev *dev, struct cpumask *mask)
+{
+	struct queue *q;
+
+	if(dev->single && dev->assigned_cpu >= 0)
+		cpumask_set(mask, dev->assigned_cpu);
+	jl_foreach(dev->rxq, q)
+		if(q->assigned_cpu >= 0)
+			cpumask_set(mask, q->assigned_cpu);
+	jl_foreach(dev->txrxq, q)
+		if(q->assigned_cpu >= 0)
+			cpumask_set(mask, q->assigned_cpu);
+}
+
+/*
+ * Place slaves of a bond or team jointly. Queue i of every slave is
+ * placed before queue i+1 of any, each on the CPU of the slave's node
+ * with the fewest group queues so far. rx-0 of two slaves thus never
+ * share a CPU while there are CPUs left. When the strategy has placed
+ * the slaves, their queues are re-balanced the same way over the CPUs
+ * the strategy gave the group as a whole.
+ */
+static int group_preassign(struct jlhead *devices)
+{
+	struct dev *dev, *m, *members[64];
+	struct cpumask mask, pool;
+	int *load;
+	int nmembers, maxq, i, j, cpu, c;
+
+	load = arena_alloc(var.arena, sizeof(int) * MAXCPU);
+	if(!load) return -1;
+
+	jl_foreach(devices, dev) {
+		if(!dev->group)
+			continue;
+		/* handle each group at its first member */
+		nmembers = 0;
+		jl_foreach(devices, m)
+			if(m->group && !strcmp(m->group, dev->group) && nmembers < 64)
+				members[nmembers++] = m;
+		if(members[0] != dev)
+			continue;
+
+		memset(load, 0, sizeof(int) * MAXCPU);
+		maxq = 0;
+		cpumask_zero(&pool);
+		for(j=0;j<nmembers;j++) {
+			maxq = MAX(maxq, MAX(1, MAX(members[j]->rx, members[j]->txrx)));
+			group_strategy_cpus(members[j], &pool);
+		}
+
+		for(i=0;i<maxq;i++)
+			for(j=0;j<nmembers;j++) {
+				m = members[j];
+				if(i >= MAX(1, MAX(m->rx, m->txrx)))
+					continue;
+				dev_cpus(m, &mask);
+				if(cpumask_weight(&pool)) {
+					/* the slave's node within the pool if
+					   it has any of it */
+					cpumask_and(&mask, &pool);
+					if(!cpumask_weight(&mask))
+						mask = pool;
+				}
+				cpu = -1;
+				for(c=0;c<var.nr_cpu;c++) {
+					if(!cpumask_isset(&mask, c))
+						continue;
+					if(cpu < 0 || load[c] < load[cpu])
+						cpu = c;
+				}
+				if(cpu < 0)
+					continue;
+				load[cpu]++;
+				group_pin(m, i, cpu);
+			}
+		if(conf.debug)
+			printf("group %s: %d slaves placed jointly\n",
+			       dev->group, nmembers);
+	}
+	return 0;
+}
+
+static void weighted_add(struct jlhead *l, struct dev *dev, struct queue *q)
+{
+	struct rate *r;
+
+	r = arena_alloc(var.arena, sizeof(struct rate));
+	if(!r) return;
+	r->dev = dev;
+	r->q = q;
+	/* queues missing from the profile still count, so they spread */
+	r->rate = (q ? q->weight : dev->weight) + 1;
+	r->cpu = -1;
+	jl_ins(l, r);
+}
+
+/*
+ * Bin-pack queues by weight, heaviest first, each onto the least loaded
+ * CPU of its device's node. Keeps the peak per-CPU load low.
+ */
+static int strategy_weighted(struct jlhead *devices)
+{
+	struct jlhead *l;
+	struct rate *r;
+	struct dev *dev;
+	struct queue *q;
+	struct cpumask mask;
+	double *load;
+	int i, cpu;
+
+	load = arena_alloc(var.arena, sizeof(double) * MAXCPU);
+	if(!load) return -1;
+	memset(load, 0, sizeof(double) * MAXCPU);
+
+	l = jl_new();
+	jl_sort(l, ratecmp);
+	jl_foreach(devices, dev) {
+		if(dev->single) {
+			weighted_add(l, dev, NULL);
+			continue;
+		}
+		jl_foreach(dev->rxq, q)
+			weighted_add(l, dev, q);
+		jl_foreach(dev->txq, q)
+			weighted_add(l, dev, q);
+		jl_foreach(dev->txrxq, q)
+			weighted_add(l, dev, q);
+	}
+
+	jl_foreach(l, r) {
+		dev_cpus(r->dev, &mask);
+		cpu = -1;
+		for(i=0;i<var.nr_cpu;i++) {
+			if(!cpumask_isset(&mask, i))
+				continue;
+			if(cpu < 0 || load[i] < load[cpu])
+				cpu = i;
+		}
+		if(cpu < 0)
+			continue;
+		load[cpu] += r->rate;
+		if(r->q) {
+			r->q->assigned_cpu = cpu;
+			r->q->reason = "weighted";
+		} else {
+			r->dev->assigned_cpu = cpu;
+			r->dev->reason = "weighted";
+		}
+		if(conf.debug)
+			printf("weighted: %s %.1f -> cpu %d\n",
+			       r->q ? r->q->name : r->dev->name, r->rate, cpu);
+	}
+	return 0;
+}
+
+/* qsort() on an array of struct dev *. a device is in one list only */
+static int speedcmp(const void *i1, const void *i2)
+{
+	const struct dev *d1=*(struct dev * const *)i1, *d2=*(struct dev * const *)i2;
+
+	if(d1->speed == d2->speed)
+		return strcmp(d1->name, d2->name);
+	return d2->speed - d1->speed;
+}
+
+static int cpu_node(int cpu)
+{
+	struct memnode *node;
+
+	jl_foreach(conf.memnodes, node)
+		if(node->cpu[cpu])
+			return node->n;
+	return -1;
+}
+
+/* pin the irq queues of dev over cpus, starting at index start */
+static int pin_dev(struct dev *dev, const int *cpus, int n, int start,
+		   const char *reason)
+{
+	struct queue *q;
+	int i;
+
+	if(dev->single) {
+		dev->assigned_cpu = cpus[start % n];
+		dev->reason = reason;
+		return start+1;
+	}
+	/* tx-N goes with rx-N */
+	i = start;
+	jl_foreach(dev->rxq, q) {
+		q->assigned_cpu = cpus[i++ % n];
+		q->reason = reason;
+	}
+	i = start;
+	jl_foreach(dev->txq, q) {
+		q->assigned_cpu = cpus[i++ % n];
+		q->reason = reason;
+	}
+	i = start;
+	jl_foreach(dev->txrxq, q) {
+		q->assigned_cpu = cpus[i++ % n];
+		q->reason = reason;
+	}
+	return start + MAX(dev->rx, dev->txrx);
+}
+
+/*
+ * --strategy speed. Share CPUs between devices in proportion to link
+ * speed. Single queue management ports and links that are down get no
+ * share; they are consolidated onto housekeeping CPUs: the reserved CPUs,
+ * or else the first usable CPU.
+ */
+static int strategy_speed(struct jlhead *devices)
+{
+	struct dev *dev, **fast;
+	int *hk, *pool, *set;
+	char *used;
+	int nhk = 0, npool = 0, nset, share, i, pass, next = 0, hknext = 0;
+	int npark = 0, nfast = 0, f, avail;
+	long total = 0;
+
+	hk = arena_alloc(var.arena, sizeof(int) * MAXCPU);
+	pool = arena_alloc(var.arena, sizeof(int) * MAXCPU);
+	set = arena_alloc(var.arena, sizeof(int) * MAXCPU);
+	used = arena_alloc(var.arena, MAXCPU);
+	fast = arena_alloc(var.arena, sizeof(struct dev *) * (devices->len+1));
+	if(!hk || !pool || !set || !used || !fast) return -1;
+	memset(used, 0, MAXCPU);
+
+	jl_foreach(devices, dev) {
+		if(dev_parked(dev)) {
+			npark++;
+			continue;
+		}
+		fast[nfast++] = dev;
+		/* unknown speed counts as a 10G link */
+		total += dev->speed > 0 ? dev->speed : 10000;
+	}
+
+	for(i=0;i<var.cpu_offset;i++)
+		hk[nhk++] = i;
+	for(i=var.cpu_offset;i<var.cpu_offset+var.nr_use_cpu;i++) {
+		if(!nhk && npark && var.nr_use_cpu > 1) {
+			hk[nhk++] = i;
+			continue;
+		}
+		pool[npool++] = i;
+	}
+	if(!nhk)
+		hk[nhk++] = var.cpu_offset;
+	avail = npool;
+
+	jl_foreach(devices, dev) {
+		if(!dev_parked(dev))
+			continue;
+		hknext = pin_dev(dev, hk, nhk, hknext, "housekeeping");
+		if(conf.debug)
+			printf("speed: %s %s on housekeeping cpus\n",
+			       dev->name, dev->down ? "link down" : "management port");
+	}
+
+	qsort(fast, nfast, sizeof(struct dev *), speedcmp);
+	for(f=0;f<nfast;f++) {
+		long speed;
+
+		dev = fast[f];
+		speed = dev->speed > 0 ? dev->speed : 10000;
+		/* what a device can not use goes to the slower ones */
+		share = (avail * speed + total/2) / total;
+		share = MAX(1, share);
+		if(share > MAX(dev->tx, MAX(dev->rx, dev->txrx)))
+			share = MAX(1, MAX(dev->tx, MAX(dev->rx, dev->txrx)));
+		avail = MAX(0, avail - share);
+		total -= speed;
+
+		/* free CPUs on the device's node first, then any free CPU,
+		   then start sharing when the pool runs out */
+		nset = 0;
+		for(pass=0;pass<2 && nset<share;pass++)
+			for(i=0;i<npool && nset<share;i++) {
+				if(used[pool[i]])
+					continue;
+				if(pass == 0 && var.multinode &&
+				   cpu_node(pool[i]) != dev->numa_node)
+					continue;
+				used[pool[i]] = 1;
+				set[nset++] = pool[i];
+			}
+		while(nset < share)
+			set[nset++] = pool[next++ % npool];
+
+		pin_dev(dev, set, nset, 0, "link speed");
+		if(conf.debug)
+			printf("speed: %s %d Mb/s gets %d cpus\n",
+			       dev->name, dev->speed, nset);
+	}
+	return 0;
+}
+
+/* memnode of a device. devices without a known node go to the first */
+static struct memnode *dev_memnode(const struct dev *dev)
+{
+	struct memnode *node;
+
+	jl_foreach(conf.memnodes, node)
+		if(node->n == dev->numa_node)
+			return node;
+	return jl_head_first(conf.memnodes);
+}
+
+static long partition_weight(const struct dev *dev)
+{
+	if(conf.partition_speed)
+		return dev->speed > 0 ? dev->speed : 10000;
+	return MAX(1, MAX(dev->tx, MAX(dev->rx, dev->txrx)));
+}
+
+/*
+ * Give every device its own contiguous slice of the CPUs on its node,
+ * sized by queue count (or link speed with --partition-by speed).
+ * Slices only overlap when a node runs out of CPUs.
+ */
+static int strategy_partition(struct jlhead *devices)
+{
+	struct memnode *node;
+	struct dev *dev;
+	int *cpus, *set;
+	int ncpus, first, last, i, next, share, avail, nq;
+	long w, total;
+
+	cpus = arena_alloc(var.arena, sizeof(int) * MAXCPU);
+	set = arena_alloc(var.arena, sizeof(int) * MAXCPU);
+	if(!cpus || !set) return -1;
+
+	first = var.cpu_offset;
+	last = var.cpu_offset + var.nr_use_cpu;
+	if(!conf.reserve_mq) {
+		first = 0;
+		last = var.nr_cpu;
+	}
+
+	jl_foreach(conf.memnodes, node) {
+		total = 0;
+		jl_foreach(devices, dev)
+			if(dev_memnode(dev) == node)
+				total += partition_weight(dev);
+		if(!total)
+			continue;
+
+		ncpus = 0;
+		for(i=first;i<last;i++)
+			if(node->cpu[i])
+				cpus[ncpus++] = i;
+		/* node entirely reserved: fall back to all usable CPUs */
+		if(!ncpus)
+			for(i=first;i<last;i++)
+				cpus[ncpus++] = i;
+
+		avail = ncpus;
+		next = 0;
+		jl_foreach(devices, dev) {
+			if(dev_memnode(dev) != node)
+				continue;
+			w = partition_weight(dev);
+			nq = MAX(1, MAX(dev->tx, MAX(dev->rx, dev->txrx)));
+			share = (avail * w + total/2) / total;
+			share = MAX(1, MIN(share, nq));
+			avail = MAX(0, avail - share);
+			total -= w;
+
+			for(i=0;i<share;i++)
+				set[i] = cpus[(next + i) % ncpus];
+			next += share;
+			pin_dev(dev, set, share, 0, "partition");
+			if(conf.debug) {
+				struct cpumask mask;
+				char hex[CPUMASK_SIZE], list[CPULIST_SIZE];
+
+				cpumask_zero(&mask);
+				for(i=0;i<share;i++)
+					cpumask_set(&mask, set[i]);
+				cpumask_hex(&mask, hex, sizeof(hex));
+				printf("partition: %s cpus %s of node %d\n", dev->name,
+				       demask(hex, list, sizeof(list)), node->n);
+			}
+		}
+	}
+	return 0;
+}
+
+static const struct strategy strategies[] = {
+	{ "round-robin", NULL },
+	{ "weighted", strategy_weighted },
+	{ "speed", strategy_speed },
+	{ "partition", strategy_partition },
+	{ NULL, NULL }
+};
+
+/*
+ * Threaded NAPI (--threaded-napi). With /sys/class/net/<dev>/threaded set,
+ * packet processing runs in one napi/<dev>-<napi id> kthread per NAPI
+ * instance instead of softirq context. A thread is matched to the rx
+ * queue of its id, and pinned to the CPU of that queue's irq, or with
+ * --napi-cpu sibling next to it: on an SMT sibling, else on a CPU sharing
+ * the last level cache. The kernel reports the id of each queue through
+ * netdev netlink (queue-get, Linux 6.8). Without it, ids are taken to be
+ * handed out in queue order, as drivers add one NAPI instance per queue,
+ * but only when every queue has a thread. comm holds 15 characters, so a
+ * thread whose name may have lost part of the device name or id is left
+ * alone rather than guessed at, as is one no queue claims.
+ */
+struct napi {
+	int pid;
+	int id; /* napi id */
+	char *comm;
+};
+
+static int napicmp(const void *i1, const void *i2)
+{
+	const struct napi *n1=i1, *n2=i2;
+
+	return n1->id - n2->id;
+}
+
+/* kthreads of dev with a napi id, ordered by id. *cut counts those with cut names */
+static struct jlhead *napi_threads(const struct dev *dev, int *cut)
+{
+	DIR *d;
+	struct dirent *ent;
+	struct jlhead *l;
+	struct napi *napi;
+	char fn[256], buf[64], prefix[32];
+	char *end;
+	int fd, n, plen;
+
+	l = jl_new();
+	jl_sort(l, napicmp);
+	*cut = 0;
+	d = opendir(conf.procdir);
+	if(!d) return l;
+
+	plen = snprintf(prefix, sizeof(prefix), "napi/%s-", dev->name);
+	while((ent = readdir(d))) {
+		if(ent->d_name[0] < '1' || ent->d_name[0] > '9')
+			continue;
+		if(snprintf(fn, sizeof(fn), "%s/%s/comm", conf.procdir,
+			    ent->d_name) >= (int)sizeof(fn))
+			continue;
+		fd = open(fn, O_RDONLY);
+		if(fd == -1)
+			continue;
+		n = read(fd, buf, sizeof(buf)-1);
+		close(fd);
+		if(n <= 0)
+			continue;
+		buf[n] = 0;
+		buf[strcspn(buf, "\n")] = 0;
+		n = strlen(buf);
+		if(strncmp(buf, prefix, MIN(n, plen)))
+			continue;
+		if(n >= 15) {
+			(*cut)++;
+			continue;
+		}
+		if(n <= plen)
+			continue;
+		napi = arena_alloc(var.arena, sizeof(struct napi));
+		if(!napi) break;
+		napi->pid = atoi(ent->d_name);
+		napi->comm = arena_strdup(var.arena, buf);
+		napi->id = strtol(buf + plen, &end, 10);
+		if(*end)
+			continue;
+		jl_ins(l, napi);
+	}
+	closedir(d);
+	return l;
+}
+
+/* set napi_id of the rx or combined queues of dev */
+static void napi_ids(const struct dev *dev, struct jlhead *threads, int cut)
+{
+	struct jlhead *l = dev->rx ? dev->rxq : dev->txrxq;
+	struct queue *q;
+	struct napi *napi;
+	int *ids, n = 0;
+
+	jl_foreach(l, q)
+		n = MAX(n, q->n + 1);
+	/* the ifindex of a --sysdir tree is not the kernel's */
+	if(n && dev->ifindex > 0 && !strcmp(conf.sysdir, "/sys") &&
+	   (ids = arena_alloc(var.arena, sizeof(int) * n)) &&
+	   (n = nl_queue_napi(dev->ifindex, ids, n)) >= 0) {
+		jl_foreach(l, q)
+			q->napi_id = q->n < n ? ids[q->n] : 0;
+		return;
+	}
+	if(cut || threads->len != l->len) {
+		if(conf.verbose && threads->len)
+			printf("%s: %d napi threads for %d queues, ids not matched\n",
+			       dev->name, threads->len, l->len);
+		return;
+	}
+	napi = jl_head_first(threads);
+	jl_foreach(l, q) {
+		q->napi_id = napi->id;
+		napi = jl_next(napi);
+	}
+}
+
+/* the rx or combined queue served by napi instance id, NULL if none */
+static struct queue *napi_queue(const struct dev *dev, int id)
+{
+	struct queue *q;
+
+	jl_foreach(dev->rx ? dev->rxq : dev->txrxq, q)
+		if(q->napi_id == id)
+			return q;
+	return NULL;
+}
+
+static int napi_pin(const struct dev *dev, const struct napi *napi, int cpu)
+{
+	struct cpumask mask;
+	char buf[CPUMASK_SIZE], cpus[CPULIST_SIZE];
+	cpu_set_t set;
+	const char *reason = "irq cpu";
+	int i, first, last;
+
+	if(conf.reset) {
+		all_cpu_mask(&mask, buf, sizeof(buf));
+		reason = "reset";
+	} else {
+		if(conf.napi_sibling) {
+			dev_range(dev, &first, &last);
+			cpu = cpu_neighbour(cpu, first, last);
+			reason = "irq neighbour";
+		}
+		cpu_mask(&mask, buf, sizeof(buf), cpu);
+	}
+	demask(buf, cpus, sizeof(cpus));
+
+	if(conf.json) {
+		printf("{\"type\":\"napi\"");
+		json_str("dev", dev->name);
+		json_str("name", napi->comm);
+		printf(",\"pid\":%d", napi->pid);
+		json_str("reason", reason);
+		json_str("new", buf);
+		json_str("new_cpus", cpus);
+		printf("}\n");
+	} else if(conf.verbose)
+		printf("napi: cpu %s [mask 0x%s] -> %s pid %d (%s)\n",
+		       cpus, buf, napi->comm, napi->pid, reason);
+	else if(!conf.quiet)
+		printf("napi %s -> %s\n", cpus, napi->comm);
+
+	/* pids of a synthetic --procdir tree are not ours to move */
+	if(conf.dryrun || strcmp(conf.procdir, "/proc"))
+		return 0;
+	CPU_ZERO(&set);
+	for(i=0;i<MAXCPU && i<CPU_SETSIZE;i++)
+		if(cpumask_isset(&mask, i))
+			CPU_SET(i, &set);
+	if(sched_setaffinity(napi->pid, sizeof(set), &set)) {
+		if(!conf.silent)
+			fprintf(stderr, "Failed to set affinity of %s pid %d\n",
+				napi->comm, napi->pid);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Turn on threaded NAPI and pin the kthreads. The threads appear when
+ * threaded is set, so this runs after the irqs are placed. They are
+ * made anew when a device is brought up or its channels change, which
+ * --watch picks up.
+ */
+static int napi_apply(struct jlhead *devices)
+{
+	struct dev *dev;
+	struct napi *napi;
+	struct queue *q;
+	struct jlhead *threads;
+	char buf[8];
+	int cut, rc = 0;
+
+	jl_foreach(devices, dev) {
+		if(dev_attr(dev, "threaded", buf, sizeof(buf))) {
+			if(conf.verbose)
+				printf("%s: no threaded NAPI support\n", dev->name);
+			continue;
+		}
+		if(!conf.dryrun && !conf.reset && strcmp(buf, "1") &&
+		   dev_attr_write(dev, "threaded", "1")) {
+			if(!conf.silent)
+				fprintf(stderr, "Failed to enable threaded NAPI for %s\n",
+					dev->name);
+			rc = -1;
+			continue;
+		}
+		threads = napi_threads(dev, &cut);
+		if(!threads->len && !cut && conf.verbose)
+			printf("%s: no napi threads running\n", dev->name);
+		if(cut && conf.verbose)
+			printf("%s: %d napi threads with cut short names left alone\n",
+			       dev->name, cut);
+		if(!dev->single)
+			napi_ids(dev, threads, cut);
+		jl_foreach(threads, napi) {
+			q = napi_queue(dev, napi->id);
+			if(q && q->assigned_cpu >= 0)
+				rc |= napi_pin(dev, napi, q->assigned_cpu);
+			else if(dev->single && dev->assigned_cpu >= 0)
+				rc |= napi_pin(dev, napi, dev->assigned_cpu);
+			else if(conf.reset)
+				rc |= napi_pin(dev, napi, 0);
+			else if(conf.verbose)
+				printf("%s: no queue with napi id %d, %s left alone\n",
+				       dev->name, napi->id, napi->comm);
+		}
+	}
+	return rc;
+}
+
+static int watch_wanted(int ifindex)
+{
+	char name[IF_NAMESIZE];
+
+	return if_indextoname(ifindex, name) && dev_wanted(name);
+}
+
+/*
+ * --watch. Stay running and configure again whenever a device comes up
+ * or its channels change. Both make new napi threads and may move the
+ * irqs, so each round is a complete run in a child process that starts
+ * from the options parsed here. Only the child returns.
+ */
+static void watch(void)
+{
+	struct nlwatch w;
+	pid_t pid;
+	int status;
+
+	if(nl_watch_open(&w)) {
+		if(!conf.silent)
+			fprintf(stderr, "Failed to watch for link changes\n");
+		exit(1);
+	}
+	while(1) {
+		fflush(stdout);
+		pid = fork();
+		if(pid == 0) {
+			nl_watch_close(&w);
+			return;
+		}
+		if(pid == -1) {
+			if(!conf.silent)
+				fprintf(stderr, "Failed to fork\n");
+		} else
+			waitpid(pid, &status, 0);
+		if(nl_watch_next(&w, -1, watch_wanted) < 0)
+			exit(1);
+		/* let a burst of changes settle */
+		while(nl_watch_next(&w, 1000, watch_wanted) > 0)
+			;
+		if(conf.verbose)
+			printf("devices changed, configuring again\n");
+	}
+}
+
+/*
+ * NAPI interrupt deferral. napi_defer_hard_irqs is how many times NAPI
+ * may poll empty before the device irq is re-armed, gro_flush_timeout
+ * (ns) the timer that polls in between. Together they trade irqs for
+ * batching. Values come from --napi-defer and --gro-flush-timeout, "N"
+ * or "dev:N,...", or with --napi-tune from how many queue irqs share the
+ * CPUs of a device: a device whose queues have CPUs to themselves keeps
+ * immediate interrupts.
+ */
+static const struct tunable {
+	const char *attr;
+	long defval; /* kernel default, set by --reset --napi-tune */
+} tunables[] = {
+	{ "napi_defer_hard_irqs", 0 },
+	{ "gro_flush_timeout", 0 },
+	{ NULL, 0 }
+};
+
+/* value for dev from a spec, -1 if none. -2 if the spec is malformed */
+static long tune_spec(const char *spec, const char *name)
+{
+	const char *p, *v;
+	char *end;
+	long val, ret = -1;
+	size_t len;
+
+	if(!spec)
+		return -1;
+	for(p=spec;*p;p=*end ? end+1 : end) {
+		v = strchr(p, ':');
+		if(!v || v > p + strcspn(p, ",")) {
+			/* plain value for all devices */
+			val = strtol(p, &end, 10);
+			if(end == p || val < 0 || (*end && *end != ','))
+				return -2;
+			ret = val;
+			continue;
+		}
+		len = v - p;
+		val = strtol(v+1, &end, 10);
+		if(end == v+1 || val < 0 || (*end && *end != ','))
+			return -2;
+		if(name && strlen(name) == len && !strncmp(p, name, len))
+			ret = val;
+	}
+	return ret;
+}
+
+/* most queue irqs planned on any one CPU that dev uses */
+static int tune_share(const struct dev *dev, const int *load)
+{
+	struct queue *q;
+	int share = 0;
+
+	jl_foreach(dev->rx ? dev->rxq : dev->txrxq, q)
+		if(q->assigned_cpu >= 0)
+			share = MAX(share, load[q->assigned_cpu]);
+	return share;
+}
+
+static void tune_print(const struct dev *dev, const char *attr, long old, long val,
+		       const char *reason)
+{
+	if(conf.json) {
+		printf("{\"type\":\"%s\"", attr);
+		json_str("dev", dev->name);
+		json_str("reason", reason);
+		printf(",\"old\":%ld,\"new\":%ld}\n", old, val);
+	} else if(conf.verbose)
+		printf("%s: %ld -> %ld %s (%s) %s/class/net/%s/%s\n",
+		       attr, old, val, dev->name, reason,
+		       conf.sysdir, dev->name, attr);
+	else if(!conf.quiet)
+		printf("%s %ld -> %s\n", attr, val, dev->name);
+}
+
+static int tune_apply(struct jlhead *devices)
+{
+	const struct tunable *t;
+	struct dev *dev;
+	struct queue *q;
+	const char *spec, *reason;
+	char buf[32];
+	int *load, share, i, rc = 0;
+	long old, val;
+
+	load = arena_alloc(var.arena, sizeof(int) * MAXCPU);
+	if(!load) return -1;
+	memset(load, 0, sizeof(int) * MAXCPU);
+	jl_foreach(devices, dev) {
+		if(dev->single && dev->assigned_cpu >= 0)
+			load[dev->assigned_cpu]++;
+		jl_foreach(dev->rx ? dev->rxq : dev->txrxq, q)
+			if(q->assigned_cpu >= 0)
+				load[q->assigned_cpu]++;
+	}
+
+	jl_foreach(devices, dev) {
+		share = tune_share(dev, load);
+		for(i=0,t=tunables;t->attr;i++,t++) {
+			if(dev_attr(dev, t->attr, buf, sizeof(buf)))
+				continue;
+			old = atol(buf);
+			spec = i ? conf.gro_flush : conf.napi_defer;
+			if( (val = tune_spec(spec, dev->name)) >= 0 ) {
+				reason = "option";
+			} else if(conf.napi_tune && conf.reset) {
+				val = t->defval;
+				reason = "reset";
+			} else if(conf.napi_tune && !dev->single) {
+				/* irqs of queues sharing a CPU are batched */
+				if(share < 2)
+					val = 0;
+				else if(i)
+					val = MIN(50000L * share, 200000L);
+				else
+					val = 2;
+				reason = "queues per cpu";
+			} else
+				continue;
+			if(conf.diff && old == val)
+				continue;
+			tune_print(dev, t->attr, old, val, reason);
+			if(conf.dryrun)
+				continue;
+			snprintf(buf, sizeof(buf), "%ld", val);
+			if(dev_attr_write(dev, t->attr, buf)) {
+				if(!conf.silent)
+					fprintf(stderr, "Failed to write %s of %s\n",
+						t->attr, dev->name);
+				rc = -1;
 			}
-			close(fd);
 		}
 	}
+	return rc;
+}
+
+/* --list */
+static void tune_list(const struct dev *dev)
+{
+	const struct tunable *t;
+	char buf[32];
+
+	for(t=tunables;t->attr;t++) {
+		if(dev_attr(dev, t->attr, buf, sizeof(buf)))
+			continue;
+		if(conf.json) {
+			printf("{\"type\":\"%s\"", t->attr);
+			json_str("dev", dev->name);
+			printf(",\"old\":%ld}\n", atol(buf));
+		} else if(conf.verbose)
+			printf("%s: %s -> %s %s/class/net/%s/%s\n", t->attr, buf,
+			       dev->name, conf.sysdir, dev->name, t->attr);
+		else
+			printf("%s %s -> %s\n", t->attr, buf, dev->name);
+	}
+}
+
+/* the CPU of a mask naming exactly one, else -1 */
+static int mask_cpu(const char *mask)
+{
+	struct cpumask m;
+	int cpu;
+
+	if(cpumask_parse(&m, mask) || cpumask_weight(&m) != 1)
+		return -1;
+	for(cpu=0;!cpumask_isset(&m, cpu);cpu++)
+		;
+	return cpu;
+}
+
+static int queue_cpu(const struct queue *q)
+{
+	if(q->assigned_cpu >= 0)
+		return q->assigned_cpu;
+	return mask_cpu(q->new_affinity ? q->new_affinity :
+			q->effective ? q->effective : q->old_affinity);
+}
+
+static void map_mask(uint32_t *words, const struct queue *q)
+{
+	struct cpumask m;
+	int i;
+
+	if(!q || cpumask_parse(&m, q->new_affinity ? q->new_affinity : q->old_affinity))
+		return;
+	for(i=0;i<ETHAFF_MASK_WORDS && i<MAXCPU/32;i++)
+		words[i] = m.w[i];
+}
+
+/* queue numbers 0..N-1 in the map, holes included */
+static int map_nqueue(const struct dev *dev)
+{
+	struct queue *q;
+	int n = 1;
+
+	if(dev->single)
+		return 1;
+	jl_foreach(dev->rxq, q)
+		n = MAX(n, q->n+1);
+	jl_foreach(dev->txq, q)
+		n = MAX(n, q->n+1);
+	jl_foreach(dev->txrxq, q)
+		n = MAX(n, q->n+1);
+	return n;
+}
+
+/*
+ * --map: publish the placement for applications, see ethaff.h.
+ * Written to a temporary file and renamed, so readers never see a
+ * partial map.
+ */
+static int map_write(const char *fn)
+{
+	struct ethaff_hdr *h;
+	struct ethaff_dev *md;
+	struct ethaff_queue *mq;
+	struct dev *dev;
+	struct queue *q;
+	struct jlhead *irqs;
+	char tmp[512];
+	size_t size;
+	int ndev = 1, nqueue = 0, n, fd, cpu;
+
+	jl_foreach(conf.devices, dev) {
+		if(dev->ifindex <= 0)
+			continue;
+		ndev = MAX(ndev, dev->ifindex+1);
+		nqueue += map_nqueue(dev);
+	}
+	size = sizeof(*h) + ndev * sizeof(*md) + nqueue * sizeof(*mq);
+	h = arena_alloc(var.arena, size);
+	if(!h) return -1;
+	memset(h, 0, size);
+	h->magic = ETHAFF_MAGIC;
+	h->version = ETHAFF_VERSION;
+	h->ndev = ndev;
+	h->nqueue = nqueue;
+	h->generation = time(NULL);
+
+	nqueue = 0;
+	jl_foreach(conf.devices, dev) {
+		if(dev->ifindex <= 0)
+			continue;
+		md = (struct ethaff_dev *)ethaff_devs(h) + dev->ifindex;
+		strncpy(md->name, dev->name, sizeof(md->name)-1);
+		md->node = dev->numa_node;
+		md->first = nqueue;
+		md->nqueue = map_nqueue(dev);
+		mq = (struct ethaff_queue *)ethaff_queues(h) + nqueue;
+		nqueue += md->nqueue;
+		for(n=0;n<md->nqueue;n++) {
+			mq[n].irq = mq[n].tx_irq = -1;
+			mq[n].cpu = mq[n].tx_cpu = mq[n].node = -1;
+			map_mask(mq[n].rps, queue_n(dev->rpsq, n));
+			map_mask(mq[n].xps, queue_n(dev->xpsq, n));
+		}
+		if(dev->single) {
+			mq[0].irq = dev->irq;
+			cpu = dev->assigned_cpu;
+			if(cpu < 0)
+				cpu = mask_cpu(dev->new_affinity ? dev->new_affinity :
+					       dev->effective ? dev->effective :
+					       dev->old_affinity);
+			mq[0].cpu = mq[0].tx_cpu = cpu;
+			mq[0].node = cpu >= 0 ? cpu_node(cpu) : -1;
+			continue;
+		}
+		irqs = dev->rx ? dev->rxq : dev->txrxq;
+		jl_foreach(irqs, q) {
+			if(q->n >= md->nqueue)
+				continue;
+			mq[q->n].irq = q->irq;
+			mq[q->n].cpu = queue_cpu(q);
+			mq[q->n].node = mq[q->n].cpu >= 0 ? cpu_node(mq[q->n].cpu) : -1;
+			if(!dev->tx)
+				mq[q->n].tx_cpu = mq[q->n].cpu;
+		}
+		jl_foreach(dev->txq, q) {
+			if(q->n >= md->nqueue)
+				continue;
+			mq[q->n].tx_irq = q->irq;
+			mq[q->n].tx_cpu = queue_cpu(q);
+		}
+	}
+
+	snprintf(tmp, sizeof(tmp), "%s.%d", fn, getpid());
+	fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if(fd == -1) {
+		if(!conf.silent)
+			fprintf(stderr, "Failed to open '%s'\n", tmp);
+		return -1;
+	}
+	if(write(fd, h, size) != (ssize_t)size || close(fd) || rename(tmp, fn)) {
+		if(!conf.silent)
+			fprintf(stderr, "Failed to write '%s'\n", fn);
+		unlink(tmp);
+		return -1;
+	}
 	return 0;
 }
 
+static const struct strategy *strategy_get(const char *name)
+{
+	const struct strategy *s;
+
+	for(s=strategies;s->name;s++)
+		if(!strcmp(s->name, name))
+			return s;
+	return NULL;
+}
+
 int main(int argc, char **argv)
 {
 	DIR *d;
 	char *ifname;
 	struct dirent *ent;
 	struct dev *dev;
-	int err=0;
+	int err=0, n;
 
 	var.cur_cpu = 0;
 	var.cur_mq_cpu = 0;
@@ -1420,11 +3955,22 @@ int main(int argc, char **argv)
 	var.nr_use_cpu = 1;
 	var.cpu_offset = 0;
 	
+	/* everything allocated during the run, including all lists, lives
+	   in one arena. A long running caller resets it once per cycle. */
+	var.arena = arena_new(0);
+	if(!var.arena) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	jl_ctx_set(arena_jl_ctx(var.arena));
+	
 	conf.heuristics = 1;
 	conf.procirq = "/proc/irq";
+	conf.procdir = "/proc";
 	conf.sysdir = "/sys";
 	conf.limit = jl_new();
 	conf.exclude = jl_new();
+	conf.reservations = jl_new();
 	conf.devices = jl_new();
 	conf.memnodes = jl_new();
 	conf.reserve_mq = 1;
@@ -1459,7 +4005,51 @@ int main(int argc, char **argv)
 		       " --exclude N,..  Do not configure these devices.\n"
 		       " --sysdir DIR    [/sys]\n"
 		       " --irqdir DIR    [/proc/irq]\n"
+		       " --procdir DIR   [/proc]\n"
 		       " --no-dist       Do not try to distribute over memory nodes.\n"
+		       " --timing        Report time spent per phase on stderr.\n"
+		       " --report        Summarize the resulting placement.\n"
+		       " --json          Output one JSON object per line.\n"
+		       " --diff          Only show changes against current masks.\n"
+		       " --verify        Compare current masks with the plan.\n"
+		       "                 Writes nothing. Exit status 0 if they\n"
+		       "                 match, 2 on drift, 1 on error.\n"
+		       " --prom FILE     Write interrupt counts per queue as a\n"
+		       "                 node_exporter textfile, against the\n"
+		       "                 planned masks. Writes no masks.\n"
+		       " --reserve-queues DEV:QUEUES:CPUS\n"
+		       "                 Put these queues on these CPUs, e.g.\n"
+		       "                 eth2:8-11:20-23, and keep all other\n"
+		       "                 irqs off the CPUs. May be repeated.\n"
+		       " --map FILE      Publish the queue to CPU map for\n"
+		       "                 applications, see ethaff.h.\n"
+		       "                 Usually " ETHAFF_MAP_PATH ".\n"
+		       " --measure N     Show interrupt and softirq rates over N seconds.\n"
+		       " --record FILE   With --measure, save queue rates as a profile.\n"
+		       " --profile FILE  Place queues by the rates in a recorded profile.\n"
+		       " --strategy S    round-robin, weighted, speed or partition\n"
+		       "                 [round-robin]. --profile selects weighted.\n"
+		       " --partition     Same as --strategy partition. Each device\n"
+		       "                 gets its own CPUs on its node.\n"
+		       " --partition-by queues|speed\n"
+		       "                 Size partitions by [queues] or link speed.\n"
+		       " --tx-sibling    Put tx-N irqs on an SMT sibling or cache\n"
+		       "                 neighbour of the rx-N CPU. xps follows.\n"
+		       " --threaded-napi Enable threaded NAPI and pin the napi\n"
+		       "                 kthreads with their queues.\n"
+		       " --napi-cpu irq|sibling\n"
+		       "                 Run napi threads on the [irq] CPU or an\n"
+		       "                 SMT sibling/cache neighbour of it.\n"
+		       " --watch         Stay running. Configure again when a\n"
+		       "                 device comes up or its channels change,\n"
+		       "                 pinning the new napi threads.\n"
+		       " --napi-defer N|DEV:N,..\n"
+		       "                 Set napi_defer_hard_irqs.\n"
+		       " --gro-flush-timeout NS|DEV:NS,..\n"
+		       "                 Set gro_flush_timeout.\n"
+		       " --napi-tune     Set both by how many queues share a CPU,\n"
+		       "                 for devices not given above. With\n"
+		       "                 --reset, set both to the kernel default.\n"
 		       "\n"
 			);
 		exit(0);
@@ -1470,6 +4060,16 @@ int main(int argc, char **argv)
 		conf.list = 1;
 	if(jelopt(argv, 0, "debug", NULL, &err))
 		conf.debug = 1;
+	if(jelopt(argv, 0, "timing", NULL, &err))
+		conf.timing = 1;
+	if(jelopt(argv, 0, "report", NULL, &err))
+		conf.report = 1;
+	if(jelopt(argv, 0, "json", NULL, &err))
+		conf.json = 1;
+	if(jelopt(argv, 0, "diff", NULL, &err))
+		conf.diff = 1;
+	if(jelopt(argv, 0, "verify", NULL, &err))
+		conf.verify = conf.dryrun = 1;
 	if(jelopt(argv, 0, "reset", NULL, &err)) {
 		conf.reset = 1;
 		conf.heuristics = 0;
@@ -1490,6 +4090,47 @@ int main(int argc, char **argv)
 		;
 	if(jelopt(argv, 0, "irqdir", &conf.procirq, &err))
 		;
+	if(jelopt(argv, 0, "procdir", &conf.procdir, &err))
+		;
+	if(jelopt(argv, 0, "prom", &conf.promfile, &err))
+		conf.dryrun = 1;
+	if(jelopt(argv, 0, "map", &conf.mapfile, &err))
+		;
+	if(jelopt(argv, 0, "record", &conf.recordfile, &err))
+		;
+	if(jelopt(argv, 0, "profile", &conf.profilefile, &err))
+		conf.strategy = "weighted";
+	if(jelopt(argv, 0, "strategy", &conf.strategy, &err))
+		;
+	if(jelopt(argv, 0, "partition", NULL, &err))
+		conf.strategy = "partition";
+	if(jelopt(argv, 0, "partition-by", &ifname, &err)) {
+		if(!strcmp(ifname, "speed"))
+			conf.partition_speed = 1;
+		else if(strcmp(ifname, "queues"))
+			err |= 128;
+	}
+	if(jelopt(argv, 0, "tx-sibling", NULL, &err))
+		conf.tx_sibling = 1;
+	if(jelopt(argv, 0, "threaded-napi", NULL, &err))
+		conf.threaded_napi = 1;
+	if(jelopt(argv, 0, "napi-cpu", &ifname, &err)) {
+		conf.threaded_napi = 1;
+		if(!strcmp(ifname, "sibling"))
+			conf.napi_sibling = 1;
+		else if(strcmp(ifname, "irq"))
+			err |= 128;
+	}
+	if(jelopt(argv, 0, "watch", NULL, &err))
+		conf.watch = 1;
+	if(jelopt(argv, 0, "napi-defer", &conf.napi_defer, &err))
+		if(tune_spec(conf.napi_defer, NULL) == -2) err |= 128;
+	if(jelopt(argv, 0, "gro-flush-timeout", &conf.gro_flush, &err))
+		if(tune_spec(conf.gro_flush, NULL) == -2) err |= 128;
+	if(jelopt(argv, 0, "napi-tune", NULL, &err))
+		conf.napi_tune = 1;
+	while(jelopt(argv, 0, "reserve-queues", &ifname, &err))
+		if(reservation_add(ifname)) err |= 128;
 	if(jelopt(argv, 0, "devices", &ifname, &err))
 		ins_comma_list(conf.limit, ifname);
 	if(jelopt(argv, 0, "exclude", &ifname, &err))
@@ -1500,10 +4141,24 @@ int main(int argc, char **argv)
 		if(!conf.maxq) err |= 128;
 	if(jelopt_int(argv, 'r', "reserve", &conf.reservedcpus, &err))
 		;
+	if(jelopt_int(argv, 0, "measure", &conf.measure, &err))
+		if(conf.measure < 1) err |= 128;
 	
 	argc = jelopt_final(argv, &err);
 
-	if(conf.quiet) conf.verbose = 0;
+	if(conf.quiet || conf.json) conf.verbose = 0;
+
+	var.strategy = &strategies[0];
+	if(conf.strategy && !(var.strategy = strategy_get(conf.strategy))) {
+		var.strategy = &strategies[0];
+		err |= 128;
+	}
+	if(var.strategy->preassign == strategy_weighted && !conf.profilefile)
+		err |= 128;
+	if(conf.recordfile && !conf.measure)
+		err |= 128;
+	if(conf.watch && (conf.list || conf.measure || conf.dryrun))
+		err |= 128;
 	
 	if(err) {
 		if(!conf.silent)
@@ -1512,6 +4167,11 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
+	if(conf.watch)
+		watch();
+
+	phase_done(NULL);
+
 	if(cpu_online()) {
 		if(!conf.silent)
 			fprintf(stderr,
@@ -1562,6 +4222,7 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
+	scan_msi();
 	while((ent = readdir(d))) {
 		scan(conf.devices, ent, conf.procirq);
 	}
@@ -1571,6 +4232,8 @@ int main(int argc, char **argv)
 	
 	scan_rps();
 	scan_xps();
+	scan_groups();
+	phase_done("scan");
 
 	if(conf.verbose > 1) {
 		jl_foreach(conf.devices, dev) {
@@ -1583,41 +4246,69 @@ int main(int argc, char **argv)
 		}
 	}
 	
+	if(conf.measure) {
+		if(measure(conf.measure))
+			exit(1);
+		exit(0);
+	}
+
 	if(conf.list) {
+		char cpus[CPULIST_SIZE];
+
 		jl_foreach(conf.devices, dev) {
+			if(conf.json) {
+				struct queue *q;
+
+				json_dev(dev);
+				if(dev->single)
+					json_queue("irq", dev, NULL, NULL);
+				jl_foreach(dev->rxq, q)
+					json_queue("irq", dev, q, NULL);
+				jl_foreach(dev->txq, q)
+					json_queue("irq", dev, q, NULL);
+				jl_foreach(dev->txrxq, q)
+					json_queue("irq", dev, q, NULL);
+				if(dev->single || dev->rx == 1)
+					jl_foreach(dev->rpsq, q)
+						json_queue("rps", dev, q, NULL);
+				jl_foreach(dev->xpsq, q)
+					json_queue("xps", dev, q, NULL);
+				tune_list(dev);
+				continue;
+			}
 			if(dev->single) {
 				struct queue *q;
 				if(conf.verbose)
 					printf("irq: cpu %s [mask 0x%s] -> %s@%d\n",
-					       demask(dev->old_affinity),
+					       demask(dev->old_affinity, cpus, sizeof(cpus)),
 					       dev->old_affinity, dev->name,
 					       dev->numa_node);
 				else
 					printf("irq %s -> %s\n",
-					       demask(dev->old_affinity),
+					       demask(dev->old_affinity, cpus, sizeof(cpus)),
 					       dev->name);
 				for(q=jl_head_first(dev->rpsq);q;q=jl_next(q)) {
 					if(conf.verbose)
 						printf("rps: cpu %s [mask 0x%s] -> %s@%d\n",
-						       demask(q->old_affinity),
+						       demask(q->old_affinity, cpus, sizeof(cpus)),
 						       q->old_affinity,
 						       q->name,
 						       dev->numa_node);
 					else
 						printf("rps %s -> %s\n",
-						       demask(q->old_affinity),
+						       demask(q->old_affinity, cpus, sizeof(cpus)),
 						       q->name);
 				}
 				for(q=jl_head_first(dev->xpsq);q;q=jl_next(q)) {
 					if(conf.verbose)
 						printf("xps: cpu %s [mask 0x%s] -> %s@%d\n",
-						       demask(q->old_affinity),
+						       demask(q->old_affinity, cpus, sizeof(cpus)),
 						       q->old_affinity,
 						       q->name,
 						       dev->numa_node);
 					else
 						printf("xps %s -> %s\n",
-						       demask(q->old_affinity),
+						       demask(q->old_affinity, cpus, sizeof(cpus)),
 						       q->name);
 				}
 			} else {
@@ -1626,85 +4317,142 @@ int main(int argc, char **argv)
 				for(q=jl_head_first(dev->rxq);q;q=jl_next(q)) {
 					if(conf.verbose)
 						printf("irq: cpu %s [mask 0x%s] -> %s@%d\n",
-						       demask(q->old_affinity),
+						       demask(q->old_affinity, cpus, sizeof(cpus)),
 						       q->old_affinity,
 						       q->name,
 						       dev->numa_node);
 					else
 						printf("irq %s -> %s\n",
-						       demask(q->old_affinity),
+						       demask(q->old_affinity, cpus, sizeof(cpus)),
 						       q->name);
 				}
 				for(q=jl_head_first(dev->txq);q;q=jl_next(q)) {
 					if(conf.verbose)
 						printf("irq: cpu %s [mask 0x%s] -> %s\n",
-						       demask(q->old_affinity),
+						       demask(q->old_affinity, cpus, sizeof(cpus)),
 						       q->old_affinity, q->name);
 					else
 						printf("irq %s -> %s\n",
-						       demask(q->old_affinity),
+						       demask(q->old_affinity, cpus, sizeof(cpus)),
 						       q->name);
 				}
 				for(q=jl_head_first(dev->txrxq);q;q=jl_next(q)) {
 					if(conf.verbose)
 						printf("irq: cpu %s [mask 0x%s] -> %s@%d\n",
-						       demask(q->old_affinity),
+						       demask(q->old_affinity, cpus, sizeof(cpus)),
 						       q->old_affinity,
 						       q->name,
 						       dev->numa_node);
 					else
 						printf("irq %s -> %s\n",
-						       demask(q->old_affinity),
+						       demask(q->old_affinity, cpus, sizeof(cpus)),
 						       q->name);
 				}
 				if(dev->rx == 1)
 				for(q=jl_head_first(dev->rpsq);q;q=jl_next(q)) {
 					if(conf.verbose)
 						printf("rps: cpu %s [mask 0x%s] -> %s@%d\n",
-						       demask(q->old_affinity),
+						       demask(q->old_affinity, cpus, sizeof(cpus)),
 						       q->old_affinity,
 						       q->name,
 						       dev->numa_node);
 					else
 						printf("rps %s -> %s\n",
-						       demask(q->old_affinity),
+						       demask(q->old_affinity, cpus, sizeof(cpus)),
 						       q->name);
 				}
 				for(q=jl_head_first(dev->xpsq);q;q=jl_next(q)) {
 					if(conf.verbose)
 						printf("xps: cpu %s [mask 0x%s] -> %s-%d@%d\n",
-						       demask(q->old_affinity),
+						       demask(q->old_affinity, cpus, sizeof(cpus)),
 						       q->old_affinity,
 						       q->name, q->n,
 						       dev->numa_node);
 					else
 						printf("xps %s -> %s-%d\n",
-						       demask(q->old_affinity),
+						       demask(q->old_affinity, cpus, sizeof(cpus)),
 						       q->name, q->n);
 				}
 			}
+			tune_list(dev);
 		}
+		phase_done("list");
+		if(conf.mapfile && map_write(conf.mapfile))
+			exit(1);
 		exit(0);
 	}
 	
 	set_heuristics(conf.devices);
+	phase_done("heuristics");
 
-	if(conf.reset) {
-		jl_foreach(conf.devices, dev) {
+	if(conf.profilefile && profile_read(conf.profilefile))
+		exit(1);
+
+	var.plan = jl_new();
+	scan_managed(conf.devices);
+	if(!conf.reset && var.strategy->preassign)
+		var.strategy->preassign(conf.devices);
+	if(!conf.reset) {
+		group_preassign(conf.devices);
+		reserve_preassign(conf.devices);
+		managed_preassign(conf.devices);
+	}
+	jl_foreach(conf.devices, dev) {
+		if(conf.reset) {
 			if(dev->single)
 				reset_singleq(dev);
 			else
 				reset_multiq(dev);
-		}
-	}
-
-	if(!conf.reset)
-		jl_foreach(conf.devices, dev) {
+		} else {
 			if(dev->single)
 				aff_singleq(dev);
 			else
 				aff_multiq(dev);
 		}
+	}
+	phase_done("plan");
+
+	if(conf.promfile) {
+		if(prom_write(conf.promfile))
+			exit(1);
+		phase_done("prom");
+		exit(0);
+	}
+
+	if(conf.verify) {
+		n = plan_drift(var.plan);
+		phase_done("verify");
+		exit(n);
+	}
+
+	plan_apply(var.plan);
+	phase_done("apply");
+
+	if(!conf.dryrun) {
+		plan_verify(var.plan);
+		phase_done("verify");
+	}
+
+	if(conf.threaded_napi) {
+		napi_apply(conf.devices);
+		phase_done("napi");
+	}
+
+	/* a plain --reset leaves the NAPI settings alone */
+	if(conf.napi_defer || conf.gro_flush || conf.napi_tune) {
+		tune_apply(conf.devices);
+		phase_done("tune");
+	}
+
+	/* a dry run has nothing to publish */
+	if(conf.mapfile && !conf.dryrun) {
+		if(map_write(conf.mapfile))
+			exit(1);
+		phase_done("map");
+	}
+
+	if(conf.report && !conf.silent)
+		report(conf.devices);
 	
 	exit(0);
 }
@@ -0,0 +1,189 @@
+/*
+ * File: arena.c
+ * Implements: bump allocator for short lived allocations
+ *
+ * Copyright license: According to GPL, see file COPYING in this directory.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "jelist.h"
+
+#define ARENA_CHUNK (64*1024)
+#define ARENA_ALIGN (2*sizeof(void*))
+
+struct chunk {
+	struct chunk *next;
+	size_t size, used;
+	/* data follows, aligned to ARENA_ALIGN */
+};
+
+struct arena {
+	struct chunk *chunks; /* current chunk first */
+	struct chunk *base; /* first chunk, kept over arena_reset() */
+	size_t chunksize;
+	size_t used;
+	struct jlctx *ctx; /* from arena_jl_ctx(), its hash lives in the chunks */
+};
+
+#define CHUNK_HDR ((sizeof(struct chunk)+ARENA_ALIGN-1) & ~(ARENA_ALIGN-1))
+
+static struct chunk *chunk_new(size_t size)
+{
+	struct chunk *c;
+
+	c = malloc(CHUNK_HDR + size);
+	if(c) {
+		c->next = NULL;
+		c->size = size;
+		c->used = 0;
+	}
+	return c;
+}
+
+struct arena *arena_new(size_t chunksize)
+{
+	struct arena *a;
+
+	a = malloc(sizeof(struct arena));
+	if(!a) return NULL;
+	a->chunksize = chunksize ? chunksize : ARENA_CHUNK;
+	a->used = 0;
+	a->ctx = NULL;
+	a->base = a->chunks = chunk_new(a->chunksize);
+	if(!a->chunks) {
+		free(a);
+		return NULL;
+	}
+	return a;
+}
+
+void arena_free(struct arena *a)
+{
+	struct chunk *c, *next;
+	struct jlctx *prev;
+
+	if(!a) return;
+	if(a->ctx) {
+		prev = jl_ctx_set(NULL);
+		jl_ctx_free(a->ctx);
+		jl_ctx_set(prev == a->ctx ? NULL : prev);
+	}
+	for(c=a->chunks;c;c=next) {
+		next = c->next;
+		free(c);
+	}
+	free(a);
+}
+
+/* jelist hooks. Nodes, buckets and the hash of the context are taken
+   from the arena that owns it and go with arena_reset() */
+static void *arena_jl_alloc(void *data, unsigned int size)
+{
+	return arena_alloc(data, size);
+}
+
+static void *arena_jl_free(void *ptr)
+{
+	return NULL;
+}
+
+static struct jlctx *arena_ctx_new(struct arena *a)
+{
+	struct jlctx *ctx, *prev;
+
+	ctx = jl_ctx_new();
+	if(!ctx) return NULL;
+	prev = jl_ctx_set(ctx);
+	jl_allocator_data(arena_jl_alloc, a);
+	jl_deallocator(arena_jl_free);
+	jl_ctx_set(prev);
+	return ctx;
+}
+
+struct jlctx *arena_jl_ctx(struct arena *a)
+{
+	if(!a->ctx)
+		a->ctx = arena_ctx_new(a);
+	return a->ctx;
+}
+
+void arena_reset(struct arena *a)
+{
+	struct chunk *c, *next;
+	struct jlctx *prev, *old;
+
+	for(c=a->chunks;c;c=next) {
+		next = c->next;
+		if(c != a->base)
+			free(c);
+	}
+	a->base->next = NULL;
+	a->base->used = 0;
+	a->chunks = a->base;
+	a->used = 0;
+
+	/* the lists and hash of the context went with the chunks */
+	if(a->ctx) {
+		old = a->ctx;
+		prev = jl_ctx_set(NULL);
+		jl_ctx_free(old);
+		a->ctx = arena_ctx_new(a);
+		jl_ctx_set(prev == old ? a->ctx : prev);
+	}
+}
+
+void *arena_alloc(struct arena *a, size_t size)
+{
+	struct chunk *c;
+	void *p;
+
+	size = (size + ARENA_ALIGN-1) & ~(ARENA_ALIGN-1);
+
+	c = a->chunks;
+	if(c->used + size > c->size) {
+		if(size > a->chunksize/4) {
+			/* big allocations get a chunk of their own, placed
+			   behind the current chunk so it stays in use */
+			c = chunk_new(size);
+			if(!c) return NULL;
+			c->next = a->chunks->next;
+			a->chunks->next = c;
+		} else {
+			c = chunk_new(a->chunksize);
+			if(!c) return NULL;
+			c->next = a->chunks;
+			a->chunks = c;
+		}
+	}
+	p = (char*)c + CHUNK_HDR + c->used;
+	c->used += size;
+	a->used += size;
+	return p;
+}
+
+char *arena_strndup(struct arena *a, const char *s, size_t n)
+{
+	char *p;
+
+	p = arena_alloc(a, n+1);
+	if(p) {
+		memcpy(p, s, n);
+		p[n] = 0;
+	}
+	return p;
+}
+
+char *arena_strdup(struct arena *a, const char *s)
+{
+	return arena_strndup(a, s, strlen(s));
+}
+
+size_t arena_used(const struct arena *a)
+{
+	return a->used;
+}
+
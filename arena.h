@@ -0,0 +1,46 @@
+/*
+ * File: arena.h
+ * Implements: bump allocator for short lived allocations
+ *
+ * Copyright license: According to GPL, see file COPYING in this directory.
+ *
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+struct jlctx;
+
+/*
+ * Memory is handed out from large chunks and is never freed one by one.
+ * arena_reset() releases everything allocated since the arena was created
+ * (or last reset) in one go, keeping the first chunk for reuse.
+ * An arena is not locked, so use it from one thread at a time.
+ */
+struct arena;
+
+/* chunksize 0 selects the default chunk size */
+struct arena *arena_new(size_t chunksize);
+void arena_free(struct arena *a);
+void arena_reset(struct arena *a);
+
+void *arena_alloc(struct arena *a, size_t size);
+char *arena_strdup(struct arena *a, const char *s);
+char *arena_strndup(struct arena *a, const char *s, size_t n);
+
+/* bytes handed out since creation or last reset */
+size_t arena_used(const struct arena *a);
+
+/*
+ * jelist context allocating from the arena, made on first call.
+ * Deallocation in the context is a no-op.
+ * Its hash lives in the arena, so arena_reset() replaces the context
+ * with an empty one, selecting the new one in the calling thread if the
+ * old one was selected, and arena_free() frees it. Lists of the old
+ * context are gone with the reset.
+ */
+struct jlctx *arena_jl_ctx(struct arena *a);
+
+#endif
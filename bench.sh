@@ -0,0 +1,37 @@
+#!/bin/bash
+#
+# Time the scan, heuristics, plan and apply phases of eth-affinity on synthetic
+# trees of increasing size. See gen-systree.sh.
+#
+# bench.sh [eth-affinity binary]
+#
+
+EA=${1:-./eth-affinity}
+GEN=$(dirname $0)/gen-systree.sh
+RUNS=5
+
+# nodes cpus smt devices queues
+SIZES="1 4 1 1 4
+1 16 2 2 8
+2 64 2 4 32
+4 256 2 8 64
+8 512 2 16 128"
+
+TMP=$(mktemp -d /tmp/eth-affinity-bench.XXXXXX) || exit 1
+trap "rm -rf $TMP" EXIT
+
+printf "%5s %4s %5s %6s %10s %10s %10s %10s\n" nodes cpus nics irqs scan heur plan apply
+echo "$SIZES" | while read nodes cpus smt devs queues; do
+    T=$TMP/$cpus
+    $GEN -n $nodes -c $cpus -s $smt -d $devs -q $queues $T || exit 1
+    irqs=$(ls $T/proc/irq | wc -l)
+    # best of RUNS. apply writes into the synthetic tree.
+    for((i=0;i<RUNS;i++)); do
+	$EA --sysdir $T/sys --irqdir $T/proc/irq --timing -q 2>&1 >/dev/null
+    done | awk -v n=$nodes -v c=$cpus -v d=$devs -v i=$irqs '
+	$1 == "timing:" { if(!($2 in best) || $3 < best[$2]) best[$2] = $3 }
+	END { printf "%5d %4d %5d %6d %8.3fms %8.3fms %8.3fms %8.3fms\n",
+		     n, c, d, i, best["scan"], best["heuristics"], best["plan"],
+		     best["apply"] }'
+    rm -rf $T
+done
@@ -0,0 +1,47 @@
+#!/bin/bash
+#
+# Regression check: plan every gen-systree.sh preset with eth-affinity -t and
+# --json and compare with the plans in tests/golden/<preset>.out.
+#
+# check.sh [eth-affinity binary]
+# check.sh -u [eth-affinity binary]   rewrite the golden files
+#
+# Exits 1 if any plan differs.
+#
+
+UPDATE=0
+if [ "$1" = "-u" ]; then
+    UPDATE=1
+    shift
+fi
+EA=$(readlink -f ${1:-./eth-affinity})
+DIR=$(cd $(dirname $0) && pwd)
+GEN=$DIR/gen-systree.sh
+GOLDEN=$DIR/tests/golden
+PRESETS="intel2s epyc vm router"
+
+TMP=$(mktemp -d /tmp/eth-affinity-check.XXXXXX) || exit 1
+trap "rm -rf $TMP" EXIT
+
+rc=0
+for p in $PRESETS; do
+    $GEN -p $p $TMP/$p || exit 1
+    # relative paths keep the plans free of the temporary directory
+    (cd $TMP/$p
+     for a in "-t" "-t --json"; do
+	 echo "== $a"
+	 $EA --sysdir sys --irqdir proc/irq $a 2>&1
+	 echo "rc=$?"
+     done) > $TMP/$p.out
+    if [ $UPDATE = 1 ]; then
+	mkdir -p $GOLDEN
+	cp $TMP/$p.out $GOLDEN/$p.out
+	echo "$p: updated"
+    elif diff -u $GOLDEN/$p.out $TMP/$p.out; then
+	echo "$p: ok"
+    else
+	echo "$p: FAILED"
+	rc=1
+    fi
+done
+exit $rc
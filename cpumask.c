@@ -0,0 +1,197 @@
+/*
+ * File: cpumask.c
+ * Implements: CPU mask handling
+ *
+ * Copyright license: According to GPL, see file COPYING in this directory.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "cpumask.h"
+
+static int hexval(int c)
+{
+	if(c >= '0' && c <= '9') return c - '0';
+	if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+/* append "first" or "first-last" to buf. returns new length or -1 if full */
+static int list_add(char *buf, size_t size, int len, int first, int last)
+{
+	int n;
+
+	if(first == last)
+		n = snprintf(buf+len, size-len, "%s%d", len?",":"", first);
+	else
+		n = snprintf(buf+len, size-len, "%s%d-%d", len?",":"", first, last);
+	if(n < 0 || (size_t)(len+n) >= size) {
+		buf[len] = 0;
+		return -1;
+	}
+	return len+n;
+}
+
+const char *demask(const char *mask, char *buf, size_t size)
+{
+	const char *p;
+	int v, i, bit = 0, first = -1, len = 0;
+
+	if(!mask) return "?";
+	if(*mask == '?') return mask;
+	if(!size) return "";
+	*buf = 0;
+
+	/* walk the digits from the least significant end */
+	p = mask + strlen(mask);
+	while(len >= 0) {
+		v = -1;
+		while(p > mask) {
+			p--;
+			if(*p == ',')
+				continue;
+			v = hexval(*p);
+			if(v >= 0 || (*p != '\n' && *p != ' '))
+				break;
+		}
+		for(i=0;i<4;i++,bit++) {
+			if((v > 0) && (v & (1<<i))) {
+				if(first < 0) first = bit;
+				continue;
+			}
+			if(first >= 0) {
+				len = list_add(buf, size, len, first, bit-1);
+				first = -1;
+				if(len < 0) break;
+			}
+		}
+		if(v < 0)
+			break;
+	}
+
+	if(!*buf)
+		return "na";
+	return buf;
+}
+
+void cpumask_zero(struct cpumask *m)
+{
+	memset(m, 0, sizeof(struct cpumask));
+}
+
+void cpumask_set(struct cpumask *m, int cpu)
+{
+	if(cpu >= 0 && cpu < MAXCPU)
+		m->w[cpu/32] |= 1U << (cpu%32);
+}
+
+int cpumask_isset(const struct cpumask *m, int cpu)
+{
+	if(cpu < 0 || cpu >= MAXCPU)
+		return 0;
+	return (m->w[cpu/32] >> (cpu%32)) & 1;
+}
+
+int cpumask_weight(const struct cpumask *m)
+{
+	int i, n = 0;
+
+	for(i=0;i<MAXCPU;i++)
+		n += cpumask_isset(m, i);
+	return n;
+}
+
+void cpumask_or(struct cpumask *m, const struct cpumask *o)
+{
+	int i;
+
+	for(i=0;i<MAXCPU/32;i++)
+		m->w[i] |= o->w[i];
+}
+
+void cpumask_and(struct cpumask *m, const struct cpumask *o)
+{
+	int i;
+
+	for(i=0;i<MAXCPU/32;i++)
+		m->w[i] &= o->w[i];
+}
+
+int cpumask_subset(const struct cpumask *m, const struct cpumask *o)
+{
+	int i;
+
+	for(i=0;i<MAXCPU/32;i++)
+		if(m->w[i] & ~o->w[i])
+			return 0;
+	return 1;
+}
+
+int cpumask_parse(struct cpumask *m, const char *mask)
+{
+	const char *p;
+	int v, bit = 0;
+
+	cpumask_zero(m);
+	if(!mask || *mask == '?') return -1;
+
+	for(p=mask+strlen(mask);p > mask;) {
+		p--;
+		if(*p == ',' || *p == '\n' || *p == ' ')
+			continue;
+		v = hexval(*p);
+		if(v < 0)
+			break;
+		if(bit < MAXCPU)
+			m->w[bit/32] |= (unsigned int)v << (bit%32);
+		bit += 4;
+	}
+	return 0;
+}
+
+int cpumask_parselist(struct cpumask *m, const char *list)
+{
+	const char *p = list;
+	char *end;
+	long first, last, i;
+
+	cpumask_zero(m);
+	if(!list) return -1;
+	while(*p && *p != '\n') {
+		first = strtol(p, &end, 10);
+		if(end == p || first < 0)
+			return -1;
+		last = first;
+		p = end;
+		if(*p == '-') {
+			p++;
+			last = strtol(p, &end, 10);
+			if(end == p || last < first)
+				return -1;
+			p = end;
+		}
+		for(i=first;i<=last && i<MAXCPU;i++)
+			cpumask_set(m, i);
+		if(*p == ',')
+			p++;
+		else if(*p && *p != '\n')
+			return -1;
+	}
+	return 0;
+}
+
+const char *cpumask_hex(const struct cpumask *m, char *buf, size_t size)
+{
+	int i, len = 0;
+
+	for(i=MAXCPU/32-1;i>0;i--)
+		if(m->w[i]) break;
+	len = snprintf(buf, size, "%x", m->w[i]);
+	for(i--;i>=0 && len >= 0 && (size_t)len < size;i--)
+		len += snprintf(buf+len, size-len, ",%08x", m->w[i]);
+	return buf;
+}
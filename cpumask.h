@@ -0,0 +1,52 @@
+/*
+ * File: cpumask.h
+ * Implements: CPU mask handling
+ *
+ * Copyright license: According to GPL, see file COPYING in this directory.
+ *
+ */
+
+#ifndef CPUMASK_H
+#define CPUMASK_H
+
+#include <stddef.h>
+
+#define MAXCPU 1024
+
+/* room for a fully fragmented cpulist of a large system */
+#define CPULIST_SIZE 2048
+/* room for a hex mask of MAXCPU bits with a comma every 32 bits */
+#define CPUMASK_SIZE (MAXCPU/4 + MAXCPU/32 + 1)
+
+/* bitmap in 32 bit words, the grouping used by the kernel */
+struct cpumask {
+	unsigned int w[MAXCPU/32];
+};
+
+void cpumask_zero(struct cpumask *m);
+void cpumask_set(struct cpumask *m, int cpu);
+int cpumask_isset(const struct cpumask *m, int cpu);
+int cpumask_weight(const struct cpumask *m);
+void cpumask_or(struct cpumask *m, const struct cpumask *o);
+void cpumask_and(struct cpumask *m, const struct cpumask *o);
+/* 1 if all CPUs in m are also in o */
+int cpumask_subset(const struct cpumask *m, const struct cpumask *o);
+
+/* parse a hex mask of any width. bits above MAXCPU are ignored */
+int cpumask_parse(struct cpumask *m, const char *mask);
+
+/* parse a cpulist ("0-3,8"), as found in sysfs. -1 if malformed */
+int cpumask_parselist(struct cpumask *m, const char *list);
+
+/* hex mask suitable for smp_affinity ("ff", "1,00000000") */
+const char *cpumask_hex(const struct cpumask *m, char *buf, size_t size);
+
+/*
+ * Format a hex CPU mask as found in smp_affinity ("ff", "00ff,ffff0000")
+ * as a cpulist with ranges ("0-7,16-23") into buf.
+ * The mask may be of any width. No memory is allocated.
+ * Returns buf, "na" for an empty mask and the mask itself if unknown ("?").
+ */
+const char *demask(const char *mask, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,113 @@
+/*
+ * File: ethaff.h
+ * Implements: queue to CPU map published by eth-affinity --map
+ *
+ * Copyright license: According to GPL, see file COPYING in this directory.
+ *
+ */
+
+#ifndef ETHAFF_H
+#define ETHAFF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * eth-affinity --map FILE records where the irq of every queue ended up,
+ * so applications can run the thread serving a queue on or next to that
+ * CPU without parsing text. Map the file read-only and look queues up by
+ * ifindex and rx queue number:
+ *
+ *   map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+ *   if(ethaff_check(map, size)) ...
+ *   q = ethaff_queue(map, ifindex, queue);
+ *
+ * The file is replaced with rename(), never rewritten in place, so a
+ * mapping stays consistent. Open and map it again to see a newer
+ * generation.
+ *
+ * Layout: struct ethaff_hdr, ndev struct ethaff_dev indexed by ifindex,
+ * then nqueue struct ethaff_queue. Host byte order.
+ */
+
+#define ETHAFF_MAP_PATH "/run/eth-affinity.map"
+#define ETHAFF_MAGIC 0x65616d70 /* "eamp" */
+#define ETHAFF_VERSION 1
+#define ETHAFF_CPUS 1024
+#define ETHAFF_MASK_WORDS (ETHAFF_CPUS/32)
+
+struct ethaff_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t ndev; /* highest ifindex + 1 */
+	uint32_t nqueue;
+	uint64_t generation; /* time of writing, seconds since the epoch */
+};
+
+struct ethaff_dev {
+	char name[16]; /* empty if no device has this ifindex */
+	int32_t node; /* NUMA node, -1 if unknown */
+	uint32_t first; /* index of queue 0 in the queue table */
+	uint32_t nqueue;
+	uint32_t pad;
+};
+
+struct ethaff_queue {
+	int32_t irq; /* rx or combined irq, -1 if none */
+	int32_t cpu; /* CPU serving irq, -1 if not bound to one */
+	int32_t tx_irq; /* separate tx irq, -1 if none */
+	int32_t tx_cpu;
+	int32_t node; /* NUMA node of cpu, -1 if unknown */
+	uint32_t pad;
+	uint32_t rps[ETHAFF_MASK_WORDS]; /* CPU n is bit n%32 of word n/32 */
+	uint32_t xps[ETHAFF_MASK_WORDS];
+};
+
+static inline const struct ethaff_dev *ethaff_devs(const void *map)
+{
+	return (const struct ethaff_dev *)((const struct ethaff_hdr *)map + 1);
+}
+
+static inline const struct ethaff_queue *ethaff_queues(const void *map)
+{
+	return (const struct ethaff_queue *)(ethaff_devs(map) +
+					     ((const struct ethaff_hdr *)map)->ndev);
+}
+
+/* 0 if map of size bytes is a map this header describes */
+static inline int ethaff_check(const void *map, size_t size)
+{
+	const struct ethaff_hdr *h = map;
+
+	if(size < sizeof(*h) || h->magic != ETHAFF_MAGIC ||
+	   h->version != ETHAFF_VERSION)
+		return -1;
+	if(size < sizeof(*h) + h->ndev * sizeof(struct ethaff_dev) +
+	   h->nqueue * sizeof(struct ethaff_queue))
+		return -1;
+	return 0;
+}
+
+/* device by ifindex, NULL if unknown */
+static inline const struct ethaff_dev *ethaff_dev(const void *map, unsigned int ifindex)
+{
+	const struct ethaff_dev *d;
+
+	if(ifindex >= ((const struct ethaff_hdr *)map)->ndev)
+		return NULL;
+	d = ethaff_devs(map) + ifindex;
+	return d->name[0] ? d : NULL;
+}
+
+/* rx queue of a device, NULL if unknown */
+static inline const struct ethaff_queue *ethaff_queue(const void *map, unsigned int ifindex,
+						     unsigned int queue)
+{
+	const struct ethaff_dev *d = ethaff_dev(map, ifindex);
+
+	if(!d || queue >= d->nqueue)
+		return NULL;
+	return ethaff_queues(map) + d->first + queue;
+}
+
+#endif
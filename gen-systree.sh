@@ -0,0 +1,321 @@
+#!/bin/bash
+#
+# Generate a synthetic sysfs/procfs tree for eth-affinity.
+# Use with: eth-affinity --sysdir DIR/sys --irqdir DIR/proc/irq
+#
+# Devices cycle through the IRQ naming schemes found in drivers:
+#  eth0: eth0-TxRx-N          (combined vectors)
+#  eth1: eth1-rx-N, eth1-tx-N (separate vectors)
+#  eth2: eth2-txrx-N
+#  eth3: eth3                 (single queue management port)
+#
+# With -D the multiqueue devices instead use the vector names of a driver
+# that does not prefix them with the netdev, and are found through
+# device/msi_irqs:
+#  mlx5:   mlx5_async0@pci:..., mlx5_compN@pci:...
+#  ena:    ena-mgmnt@pci:..., ethD-Tx-Rx-N
+#  virtio: virtioD-config, virtioD-input.N, virtioD-output.N
+#
+# -M marks the first queue vectors of each multiqueue device as kernel
+# managed, as the irq debugfs shows them, with effective_affinity on CPU
+# N for queue N.
+#
+# -N models threaded NAPI switched on: threaded reads 1 and there is a
+# napi/<dev>-<id> kthread per rx queue in proc/<pid>/comm. Ids rise in
+# queue order, as the kernel hands them out.
+#
+# Presets (-p) model topologies that placement changes are checked on:
+#  intel2s: 2-socket Intel, 24 cores with SMT, two 24-queue NICs
+#  epyc:    EPYC with 4 nodes (NPS4), two 8-core CCX (own L3) per node
+#  vm:      single node 8 vCPU guest, one 8-queue NIC
+#  router:  2-socket router with bond0 over eth0 and eth1
+#
+
+NODES=1
+CPUS=4
+SMT=1
+DEVS=1
+QUEUES=4
+LLC=0 # cores per LLC, 0 means per node
+BONDS=""
+DRIVER=""
+MANAGED=0
+NAPI=0
+
+function usage
+{
+    echo "gen-systree.sh [-p preset] [-n nodes] [-c cpus] [-s smt] [-l llc]"
+    echo "               [-d devices] [-q queues] [-b bond:dev,dev]"
+    echo "               [-D driver] [-M N] [-N] DIR"
+    echo " -p P  intel2s, epyc, vm or router. Later options override."
+    echo " -n N  memory nodes [$NODES]"
+    echo " -c N  CPUs (logical) [$CPUS]"
+    echo " -s N  threads per core [$SMT]"
+    echo " -d N  network devices [$DEVS]"
+    echo " -q N  queues per multiqueue device [$QUEUES]"
+    echo " -l N  cores sharing a last level cache [cores per node]"
+    echo " -b B  bonding master over devices, e.g. bond0:eth0,eth1"
+    echo " -D D  irq naming of multiqueue devices: mlx5, ena or virtio"
+    echo " -M N  kernel managed queue vectors per multiqueue device [$MANAGED]"
+    echo " -N    threaded NAPI on, with napi kthreads"
+    exit 1
+}
+
+function preset
+{
+    case $1 in
+	intel2s) NODES=2; CPUS=48; SMT=2; DEVS=2; QUEUES=24;;
+	epyc) NODES=4; CPUS=128; SMT=2; LLC=8; DEVS=2; QUEUES=32;;
+	vm) NODES=1; CPUS=8; SMT=1; DEVS=1; QUEUES=8;;
+	router) NODES=2; CPUS=32; SMT=2; DEVS=4; QUEUES=8; BONDS="bond0:eth0,eth1";;
+	*) usage;;
+    esac
+}
+
+while getopts "p:n:c:s:l:d:q:b:D:M:Nh" opt; do
+    case $opt in
+	p) preset $OPTARG;;
+	n) NODES=$OPTARG;;
+	c) CPUS=$OPTARG;;
+	s) SMT=$OPTARG;;
+	d) DEVS=$OPTARG;;
+	q) QUEUES=$OPTARG;;
+	l) LLC=$OPTARG;;
+	b) BONDS="$BONDS $OPTARG";;
+	D) DRIVER=$OPTARG;;
+	M) MANAGED=$OPTARG;;
+	N) NAPI=1;;
+	*) usage;;
+    esac
+done
+shift $((OPTIND-1))
+[ "$1" ] || usage
+DIR=$1
+
+CORES=$((CPUS/SMT))
+CPN=$((CORES/NODES)) # cores per node
+if [ $((CORES*SMT)) != $CPUS -o $((CPN*NODES)) != $CORES -o $CPN = 0 ]; then
+    echo "cpus must be a multiple of smt*nodes" 1>&2
+    exit 1
+fi
+[ $LLC = 0 ] && LLC=$CPN
+
+# hex mask of width CPUS, as printed by the kernel. $1 is the digit to fill with
+function mask
+{
+    local digits=$(( (CPUS+3)/4 )) i s=""
+    for((i=0;i<digits;i++)); do
+	if [ $i -gt 0 -a $((i%8)) = 0 ]; then s=",$s"; fi
+	s="$1$s"
+    done
+    echo $s
+}
+ALLMASK=$(mask f)
+ZEROMASK=$(mask 0)
+
+# hex mask with only CPU $1 set
+function cpumask
+{
+    local digits=$(( (CPUS+3)/4 )) i s=""
+    for((i=0;i<digits;i++)); do
+	if [ $i -gt 0 -a $((i%8)) = 0 ]; then s=",$s"; fi
+	if [ $i = $(($1/4)) ]; then s="$(( 1 << ($1%4) ))$s"; else s="0$s"; fi
+    done
+    echo $s
+}
+
+# cpulist of the cores first..first+count-1, one range per thread
+function core_cpulist
+{
+    local first=$1 count=$2 t l=""
+    for((t=0;t<SMT;t++)); do
+	l="$l${l:+,}$((t*CORES + first))-$((t*CORES + first + count - 1))"
+    done
+    echo $l
+}
+
+S=$DIR/sys
+P=$DIR/proc
+mkdir -p $S/devices/system/cpu $S/class/net $P/irq || exit 1
+
+echo "0-$((CPUS-1))" > $S/devices/system/cpu/online
+
+# cpu topology. Linux numbers all first threads of each core first.
+for((cpu=0;cpu<CPUS;cpu++)); do
+    core=$((cpu%CORES))
+    node=$((core/CPN))
+    sib=""
+    for((t=0;t<SMT;t++)); do
+	sib="$sib${sib:+,}$((t*CORES + core))"
+    done
+    T=$S/devices/system/cpu/cpu$cpu
+    mkdir -p $T/topology $T/cache/index3
+    echo $sib > $T/topology/thread_siblings_list
+    echo $core > $T/topology/core_id
+    echo $node > $T/topology/physical_package_id
+    core_cpulist $((core/LLC*LLC)) $LLC > $T/cache/index3/shared_cpu_list
+done
+
+# single node systems often have no node directory at all
+if [ $NODES -gt 1 ]; then
+    for((n=0;n<NODES;n++)); do
+	mkdir -p $S/devices/system/node/node$n
+	core_cpulist $((n*CPN)) $CPN > $S/devices/system/node/node$n/cpulist
+    done
+fi
+
+SPEEDS=(10000 25000 100000)
+irq=24
+napiid=8193
+pid=1000
+IRQLIST=""
+for((d=0;d<DEVS;d++)); do
+    dev=eth$d
+    scheme=$((d%4))
+    N=$S/class/net/$dev
+    pci=0000:$(printf %02x $((d+1))):00.0
+    PCI=$S/devices/pci0000:00/$pci
+    drv=ixgbe
+    [ $scheme = 3 ] && drv=e1000e
+    [ $scheme != 3 -a "$DRIVER" ] && drv=$DRIVER
+    case $drv in
+	mlx5) drv=mlx5_core;;
+	virtio) drv=virtio_net;;
+	ena|ixgbe|e1000e) ;;
+	*) usage;;
+    esac
+    mkdir -p $N $PCI
+    if [ $drv = virtio_net ]; then
+	# the netdev sits on a virtio device below the PCI function
+	mkdir -p $PCI/virtio$d/net/$dev $S/bus/virtio/devices
+	ln -s ../../../devices/pci0000:00/$pci/virtio$d $N/device
+	ln -s ../../../devices/pci0000:00/$pci/virtio$d $S/bus/virtio/devices/virtio$d
+	mkdir -p $S/bus/virtio/drivers/$drv
+	ln -s ../../../../bus/virtio/drivers/$drv $N/device/driver
+    else
+	ln -s ../../../devices/pci0000:00/$pci $N/device
+	mkdir -p $S/bus/pci/drivers/$drv
+	ln -s ../../../bus/pci/drivers/$drv $N/device/driver
+    fi
+    mkdir -p $PCI/msi_irqs
+    if [ $NODES -gt 1 ]; then
+	echo $((d%NODES)) > $PCI/numa_node
+    else
+	echo -1 > $PCI/numa_node
+    fi
+    echo $((d+2)) > $N/ifindex
+    echo up > $N/operstate
+    if [ $scheme = 3 ]; then
+	echo 1000 > $N/speed
+	nq=1
+    else
+	echo ${SPEEDS[$((d%3))]} > $N/speed
+	nq=$QUEUES
+    fi
+
+    echo $NAPI > $N/threaded
+    echo 0 > $N/napi_defer_hard_irqs
+    echo 0 > $N/gro_flush_timeout
+    if [ $NAPI = 1 ]; then
+	for((q=0;q<nq;q++)); do
+	    mkdir -p $P/$pid $N/queues/rx-$q
+	    echo napi/$dev-$napiid > $P/$pid/comm
+	    pid=$((pid+7)); napiid=$((napiid+1))
+	done
+    fi
+
+    for((q=0;q<nq;q++)); do
+	mkdir -p $N/queues/rx-$q $N/queues/tx-$q
+	echo $ZEROMASK > $N/queues/rx-$q/rps_cpus
+	echo $ZEROMASK > $N/queues/tx-$q/xps_cpus
+    done
+
+    case $scheme in
+	0) actions="$(for((q=0;q<nq;q++)); do echo $dev-TxRx-$q; done)";;
+	1) actions="$(for((q=0;q<nq;q++)); do echo $dev-rx-$q; done;
+		      for((q=0;q<nq;q++)); do echo $dev-tx-$q; done)";;
+	2) actions="$(for((q=0;q<nq;q++)); do echo $dev-txrx-$q; done)";;
+	3) actions="$dev";;
+    esac
+    case $drv in
+	mlx5_core) actions="mlx5_async0@pci:$pci
+			  $(for((q=0;q<nq;q++)); do echo mlx5_comp$q@pci:$pci; done)";;
+	ena) actions="ena-mgmnt@pci:$pci
+		      $(for((q=0;q<nq;q++)); do echo $dev-Tx-Rx-$q; done)";;
+	virtio_net) actions="virtio$d-config
+			     $(for((q=0;q<nq;q++)); do echo virtio$d-input.$q; done;
+			       for((q=0;q<nq;q++)); do echo virtio$d-output.$q; done)";;
+    esac
+    vec=0
+    for a in $actions; do
+	mkdir -p $P/irq/$irq/$a
+	touch $PCI/msi_irqs/$irq
+	echo $ALLMASK > $P/irq/$irq/smp_affinity
+	case $a in
+	    *async*|*mgmnt*|*config*) ;;
+	    *) if [ $nq -gt 1 -a $((vec%nq)) -lt $MANAGED ]; then
+		   mkdir -p $S/kernel/debug/irq/irqs
+		   printf "handler:  handle_edge_irq\nflags:    0x104208\n             IRQD_AFFINITY_MANAGED\n" \
+			  > $S/kernel/debug/irq/irqs/$irq
+		   cpumask $(( (vec%nq) % CPUS )) > $P/irq/$irq/effective_affinity
+	       fi
+	       vec=$((vec+1));;
+	esac
+	IRQLIST="$IRQLIST$irq $a
+"
+	irq=$((irq+1))
+    done
+done
+
+# /proc/interrupts. Each queue irq has been serviced by one CPU, with a
+# count that varies per irq so rates differ between queues.
+echo -n "$IRQLIST" | awk -v cpus=$CPUS '
+function row(label, hot, count, name,   c) {
+	printf "%4s:", label
+	for(c=0;c<cpus;c++)
+		printf " %10d", c == hot ? count : 0
+	printf "  %s\n", name
+}
+BEGIN {
+	printf "    "
+	for(c=0;c<cpus;c++)
+		printf " %10s", "CPU" c
+	printf "\n"
+	row(0, 0, 45, "IO-APIC   2-edge      timer")
+	row(9, 0, 0, "IO-APIC   9-fasteoi   acpi")
+}
+{ row($1, $1 % cpus, 1000 * ($1 % 7 + 1), "IR-PCI-MSI-edge      " $2) }
+END {
+	row("NMI", 0, 0, "Non-maskable interrupts")
+	row("LOC", 0, 123456, "Local timer interrupts")
+	printf " ERR:          0\n"
+	printf " MIS:          0\n"
+}' > $P/interrupts
+
+awk -v cpus=$CPUS 'BEGIN {
+	printf "          "
+	for(c=0;c<cpus;c++)
+		printf " %10s", "CPU" c
+	printf "\n"
+	n = split("HI TIMER NET_TX NET_RX BLOCK IRQ_POLL TASKLET SCHED HRTIMER RCU", s, " ")
+	for(i=1;i<=n;i++) {
+		printf "%10s:", s[i]
+		for(c=0;c<cpus;c++)
+			printf " %10d", s[i] == "NET_RX" ? 100 * (c % 5) : 0
+		printf "\n"
+	}
+}' > $P/softirqs
+
+# bonding masters have no IRQs, only links to their slaves
+for b in $BONDS; do
+    bond=${b%%:*}
+    N=$S/class/net/$bond
+    mkdir -p $N/bonding
+    echo ${b#*:} | tr , ' ' > $N/bonding/slaves
+    echo up > $N/operstate
+    echo $((DEVS+2)) > $N/ifindex
+    for slave in $(cat $N/bonding/slaves); do
+	ln -s ../$slave $N/lower_$slave
+	ln -s ../$bond $S/class/net/$slave/master
+    done
+done
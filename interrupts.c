@@ -0,0 +1,149 @@
+/*
+ * File: interrupts.c
+ * Implements: parsing of /proc/interrupts and /proc/softirqs
+ *
+ * Copyright license: According to GPL, see file COPYING in this directory.
+ *
+ */
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "arena.h"
+#include "interrupts.h"
+
+/* whole file into one arena string. procfs files have no usable size */
+static char *slurp(const char *fn, struct arena *a)
+{
+	char *buf = NULL, *nbuf;
+	size_t size = 0, len = 0;
+	ssize_t n;
+	int fd;
+
+	fd = open(fn, O_RDONLY);
+	if(fd == -1) return NULL;
+	for(;;) {
+		if(len + 1 >= size) {
+			size = size ? size*2 : 65536;
+			nbuf = realloc(buf, size);
+			if(!nbuf) goto err;
+			buf = nbuf;
+		}
+		n = read(fd, buf+len, size-len-1);
+		if(n < 0) goto err;
+		if(n == 0) break;
+		len += n;
+	}
+	close(fd);
+	buf[len] = 0;
+	nbuf = arena_strndup(a, buf, len);
+	free(buf);
+	return nbuf;
+err:
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+int interrupts_read(struct interrupts *in, const char *fn, struct arena *a)
+{
+	char *text, *line, *next, *p, *end;
+	int i, nlines = 0;
+	struct irqcount *row;
+
+	memset(in, 0, sizeof(struct interrupts));
+	text = slurp(fn, a);
+	if(!text) return -1;
+
+	for(p=text;*p;p++)
+		if(*p == '\n') nlines++;
+
+	/* header: "           CPU0       CPU1 ..." */
+	line = text;
+	next = strchr(line, '\n');
+	if(next) *next++ = 0;
+	for(p=line;(p = strstr(p, "CPU"));p += 3)
+		in->ncol++;
+	in->cpu = arena_alloc(a, sizeof(int) * (in->ncol ? in->ncol : 1));
+	in->rows = arena_alloc(a, sizeof(struct irqcount) * (nlines ? nlines : 1));
+	if(!in->cpu || !in->rows) return -1;
+	for(i=0,p=line;(p = strstr(p, "CPU"));p += 3)
+		in->cpu[i++] = atoi(p+3);
+
+	for(line=next;line && *line;line=next) {
+		next = strchr(line, '\n');
+		if(next) *next++ = 0;
+
+		while(isspace((unsigned char)*line)) line++;
+		p = strchr(line, ':');
+		if(!p) continue;
+		*p++ = 0;
+
+		row = &in->rows[in->n];
+		row->label = line;
+		row->irq = isdigit((unsigned char)*line) ? atoi(line) : -1;
+		row->total = 0;
+		row->count = arena_alloc(a, sizeof(unsigned long long) * (in->ncol ? in->ncol : 1));
+		if(!row->count) return -1;
+		memset(row->count, 0, sizeof(unsigned long long) * in->ncol);
+
+		/* rows such as ERR and MIS have a single counter */
+		for(i=0;i<in->ncol;i++) {
+			unsigned long long v = strtoull(p, &end, 10);
+			if(end == p) break;
+			row->count[i] = v;
+			row->total += v;
+			p = end;
+		}
+		while(isspace((unsigned char)*p)) p++;
+		row->name = p;
+		in->n++;
+	}
+	return 0;
+}
+
+struct irqcount *interrupts_irq(const struct interrupts *in, int irq)
+{
+	int lo = 0, hi = in->n - 1, mid;
+
+	/* numbered rows come first, in ascending order */
+	while(hi >= 0 && in->rows[hi].irq < 0)
+		hi--;
+	while(lo <= hi) {
+		mid = (lo + hi) / 2;
+		if(in->rows[mid].irq == irq)
+			return &in->rows[mid];
+		if(in->rows[mid].irq < irq)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return NULL;
+}
+
+struct irqcount *interrupts_label(const struct interrupts *in, const char *label)
+{
+	int i;
+
+	for(i=0;i<in->n;i++)
+		if(!strcmp(in->rows[i].label, label))
+			return &in->rows[i];
+	return NULL;
+}
+
+int interrupts_col(const struct interrupts *in, int cpu)
+{
+	int i;
+
+	/* with all cpus online column n is cpu n */
+	if(cpu >= 0 && cpu < in->ncol && in->cpu[cpu] == cpu)
+		return cpu;
+	for(i=0;i<in->ncol;i++)
+		if(in->cpu[i] == cpu)
+			return i;
+	return -1;
+}
@@ -0,0 +1,45 @@
+/*
+ * File: interrupts.h
+ * Implements: parsing of /proc/interrupts and /proc/softirqs
+ *
+ * Copyright license: According to GPL, see file COPYING in this directory.
+ *
+ */
+
+#ifndef INTERRUPTS_H
+#define INTERRUPTS_H
+
+struct arena;
+
+/* one row. label is "40" for numbered irqs, "LOC", "NET_RX" etc otherwise */
+struct irqcount {
+	char *label;
+	int irq; /* -1 when the label is not a number */
+	unsigned long long total;
+	unsigned long long *count; /* one per column */
+	char *name; /* text after the counters, empty for softirqs */
+};
+
+struct interrupts {
+	int ncol;
+	int *cpu; /* cpu number of each column, from the "CPUn" header */
+	int n;
+	struct irqcount *rows; /* in file order, numbered irqs ascending */
+};
+
+/*
+ * Read a table in the /proc/interrupts format. All memory is taken from a.
+ * Returns 0 on success, -1 if the file can not be read.
+ */
+int interrupts_read(struct interrupts *in, const char *fn, struct arena *a);
+
+/* lookup a numbered irq, NULL if not present */
+struct irqcount *interrupts_irq(const struct interrupts *in, int irq);
+
+/* lookup a row by label ("NET_RX"), NULL if not present */
+struct irqcount *interrupts_label(const struct interrupts *in, const char *label);
+
+/* column of a cpu, -1 if the cpu has no column (offline) */
+int interrupts_col(const struct interrupts *in, int cpu);
+
+#endif
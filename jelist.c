@@ -23,13 +23,34 @@ struct bucket {
   struct bucket *next;
 };
 
-int _jl_hash_store(struct listentry *entry,const void *key);
-struct listentry *_jl_hash_get(const void *key);
-int _jl_hash_del(const void *key);
-struct jlnode *_jl_node_new(const void *key);
+/* all list state. see jl_ctx_set() */
+struct jlctx {
+  struct bucket **listhash;
+  int hashsize; /* size is 2^hashsize buckets */
+  int hashcount;
+  void*(*allocfn)(unsigned int size);
+  void*(*deallocfn)(void *ptr);
+  void*(*dataallocfn)(void *data, unsigned int size);
+  void *data; /* passed to dataallocfn, e.g. the arena owning the context */
+  struct jlctx *next; /* contexts made by jl_ctx_new() */
+  int shared; /* made by jl_ctx_new(), may be reached from other threads */
+  volatile int lock; /* guards listhash of a shared context */
+};
+
+struct jlctx *_jl_ctx();
+#define _jl_head_ctx(h) ((h)->ctx ? (h)->ctx : _jl_ctx())
+struct jlnode *_jl_node_get(const void *item);
+#define _jl_node_ctx(n) _jl_head_ctx((n)->list)
+
+int _jl_hash_store(struct jlctx *ctx, struct listentry *entry,const void *key);
+struct listentry *_jl_hash_get(struct jlctx *ctx, const void *key);
+int _jl_hash_del(struct jlctx *ctx, const void *key);
+struct jlnode *_jl_node_new(struct jlctx *ctx, const void *key);
+int _jl_index_build(struct jlhead *head);
+#define _jl_index_inval(h) ((h)->indexvalid = 0)
 
-void *jl_malloc(unsigned int size);
-void jl_dealloc(void *ptr);
+void *jl_malloc(struct jlctx *ctx, unsigned int size);
+void jl_dealloc(struct jlctx *ctx, void *ptr);
 
 #endif
 /*
@@ -46,11 +67,10 @@ int jl_add_after(const void *jlnode, const void *newnode)
 {
   struct jlnode *old, *n;
 
-  old = (struct jlnode *) _jl_hash_get(jlnode);
+  old = _jl_node_get(jlnode);
   if(!old) return -1;
-  n = _jl_node_new(newnode);
+  n = _jl_node_new(_jl_node_ctx(old), newnode);
   if(!n) return -1;
-  n->item = (void*) newnode;
   n->list = old->list;
   n->next = old->next;
   n->prev = old;
@@ -61,6 +81,7 @@ int jl_add_after(const void *jlnode, const void *newnode)
     n->list->last = n;
   old->next = n;
   n->list->len++;
+  _jl_index_inval(n->list);
   return 0;
 }
 /*
@@ -77,11 +98,10 @@ int jl_add_before(const void *jlnode, const void *newnode)
 {
   struct jlnode *old, *n;
 
-  old = (struct jlnode *) _jl_hash_get(jlnode);
+  old = _jl_node_get(jlnode);
   if(!old) return -1;
-  n = _jl_node_new(newnode);
+  n = _jl_node_new(_jl_node_ctx(old), newnode);
   if(!n) return -1;
-  n->item = (void*) newnode;
   n->list = old->list;
   n->next = old;
   n->prev = old->prev;
@@ -92,6 +112,7 @@ int jl_add_before(const void *jlnode, const void *newnode)
     n->list->first = n;
   old->prev = n;
   n->list->len++;
+  _jl_index_inval(n->list);
   return 0;
 }
 /*
@@ -111,9 +132,8 @@ int jl_append(struct jlhead *head, const void *node)
   
   if(!head) return -1;
   
-  n = _jl_node_new(node);
+  n = _jl_node_new(_jl_head_ctx(head), node);
   if(!n) return -1;
-  n->item = (void*) node;
   n->list = head;
   n->next = NULL;
   n->prev = head->last;
@@ -123,6 +143,12 @@ int jl_append(struct jlhead *head, const void *node)
   
   head->last = n;
   head->len++;
+  
+  /* appending keeps the index valid if there is room for the new node */
+  if(head->indexvalid && (head->len <= head->indexsize))
+    head->index[head->len-1] = n;
+  else
+    _jl_index_inval(head);
   return 0;
 }
 /*
@@ -146,7 +172,16 @@ int jl_append_list(struct jlhead *dst, struct jlhead *src)
   if(!src->first)
     return 0;
   for(n=src->first;n;n=n->next)
-    n->list = dst;
+    {
+      /* nodes are found through the hash of the context of their list */
+      if(_jl_head_ctx(src) != _jl_head_ctx(dst))
+	{
+	  _jl_hash_del(_jl_head_ctx(src), n->item);
+	  if(_jl_hash_store(_jl_head_ctx(dst), (struct listentry*)n, n->item))
+	    return -1;
+	}
+      n->list = dst;
+    }
   if(!dst->first)
     {
       dst->first = src->first;
@@ -163,6 +198,8 @@ int jl_append_list(struct jlhead *dst, struct jlhead *src)
  out:
   src->first = src->last = NULL;
   src->len = 0;
+  _jl_index_inval(src);
+  _jl_index_inval(dst);
   return 0;
 }
 /*
@@ -177,9 +214,13 @@ int jl_append_list(struct jlhead *dst, struct jlhead *src)
 #include <stdlib.h>
 #include <string.h>
 
-int hashsize=0; /* size is 2^hashsize buckets */
-int hashcount=0;
-struct bucket **listhash;
+/* default context of each thread */
+static __thread struct jlctx defctx;
+static __thread struct jlctx *curctx;
+/* all contexts from jl_ctx_new(), guarded by ctxlock */
+static struct jlctx *ctxlist;
+static volatile int ctxlock;
+
 /* hashkey: fold pointer so that the bits for pagenumber are used.
    logic and with size. */
 
@@ -190,27 +231,27 @@ struct bucket **listhash;
  jl_next() will lookup the keynode in the hash and return n->next->item.
 */
 
-static unsigned int _hash(const void *key)
+static unsigned int _hash(const struct jlctx *ctx, const void *key)
 {
-  unsigned int k = (unsigned int) key;
+  unsigned int k = (unsigned long) key;
   k ^= (k >> 3);
   /* k ^= (k >> 9); */
-  return k & ((1 << hashsize)-1);
+  return k & ((1 << ctx->hashsize)-1);
 }
 
-static int _alloc_jelist()
+static int _alloc_jelist(struct jlctx *ctx)
 {
-  hashsize += 2;
-  listhash = jl_malloc(sizeof(void*)*(1<<hashsize));
-  memset(listhash, 0, sizeof(void*)*(1<<hashsize));
+  ctx->hashsize += 2;
+  ctx->listhash = jl_malloc(ctx, sizeof(void*)*(1<<ctx->hashsize));
+  memset(ctx->listhash, 0, sizeof(void*)*(1<<ctx->hashsize));
   return 0;
 }
 
-int _hash_put_bkt(struct bucket **hash, struct bucket *bkt)
+int _hash_put_bkt(struct jlctx *ctx, struct bucket **hash, struct bucket *bkt)
 {
   int idx;
 
-  idx = _hash(bkt->item->t.node.item);
+  idx = _hash(ctx, bkt->item->t.node.item);
   if(hash[idx])
     {
       bkt->next = hash[idx];
@@ -224,110 +265,135 @@ int _hash_put_bkt(struct bucket **hash, struct bucket *bkt)
   return 0;
 }
 
-static int _realloc_jelist()
+static int _realloc_jelist(struct jlctx *ctx)
 {
   struct bucket **nhash, *bkt, *nbkt;
-  int oldsize = hashsize;
+  int oldsize = ctx->hashsize;
   int i, count=0;
   
-  if(hashcount > (1<<(hashsize+1)))
-    hashsize += 2;
+  if(ctx->hashcount > (1<<(ctx->hashsize+1)))
+    ctx->hashsize += 2;
   else
     {
-      while( (hashsize > 2) &&
-	     (hashcount < (1<<(hashsize+1))) )
-	hashsize -= 1;
+      while( (ctx->hashsize > 2) &&
+	     (ctx->hashcount < (1<<(ctx->hashsize+1))) )
+	ctx->hashsize -= 1;
 
-      if(hashsize == oldsize)
+      if(ctx->hashsize == oldsize)
 	return 0;
     }
 
-  nhash = jl_malloc(sizeof(void*)*(1<<hashsize));
+  nhash = jl_malloc(ctx, sizeof(void*)*(1<<ctx->hashsize));
   if(!nhash)
     {
-      hashsize = oldsize;
+      ctx->hashsize = oldsize;
       return -1;
     }
   
-  memset(nhash, 0, sizeof(void*)*(1<<hashsize));
+  memset(nhash, 0, sizeof(void*)*(1<<ctx->hashsize));
   
   /* reinsert all buckets */
 
   for(i=0;i<(1<<oldsize);i++)
     {
-      bkt = listhash[i];
+      bkt = ctx->listhash[i];
       while(bkt)
 	{
 	  nbkt = bkt->next;
-	  _hash_put_bkt(nhash, bkt);
+	  _hash_put_bkt(ctx, nhash, bkt);
 	  count++;
 	  bkt=nbkt;
 	}
     }
 
-  if(count != hashcount)
+  if(count != ctx->hashcount)
     {
 #ifdef TESTJELIST
-      printf("error: realloc count %d != %d\n", count, hashcount);
+      printf("error: realloc count %d != %d\n", count, ctx->hashcount);
 #endif
     }
 
-  jl_dealloc(listhash);
-  listhash = nhash;
+  jl_dealloc(ctx, ctx->listhash);
+  ctx->listhash = nhash;
 
   return 0;
 }
 
-int _jl_hash_store(struct listentry *entry, const void *key)
+/* the hash of a shared context may be read by other threads looking up
+   items, so it is only touched with the context locked */
+static void _jl_lock(struct jlctx *ctx)
 {
-  struct bucket *lbkt, *nbkt;
+  if(ctx->shared)
+    while(__sync_lock_test_and_set(&ctx->lock, 1))
+      ;
+}
+
+static void _jl_unlock(struct jlctx *ctx)
+{
+  if(ctx->shared)
+    __sync_lock_release(&ctx->lock);
+}
 
-  if(!listhash)
-    _alloc_jelist();
-  if(hashcount > (1<<(hashsize+1)))
-    _realloc_jelist();
+int _jl_hash_store(struct jlctx *ctx, struct listentry *entry, const void *key)
+{
+  struct bucket *lbkt, *nbkt;
 
-  nbkt = jl_malloc(sizeof(struct bucket));
+  nbkt = jl_malloc(ctx, sizeof(struct bucket));
   if(!nbkt) return -1;
   nbkt->item = entry;
   
-  lbkt = listhash[_hash(key)];
+  _jl_lock(ctx);
+  if(!ctx->listhash)
+    _alloc_jelist(ctx);
+  if(ctx->hashcount > (1<<(ctx->hashsize+1)))
+    _realloc_jelist(ctx);
+
+  lbkt = ctx->listhash[_hash(ctx, key)];
   if(!lbkt)
     {
       nbkt->next = NULL;
-      listhash[_hash(key)] = nbkt;
-      hashcount++;
+      ctx->listhash[_hash(ctx, key)] = nbkt;
+      ctx->hashcount++;
+      _jl_unlock(ctx);
       return 0;
     }
   
   nbkt->next = lbkt;
-  listhash[_hash(key)] = nbkt;
-  hashcount++;
+  ctx->listhash[_hash(ctx, key)] = nbkt;
+  ctx->hashcount++;
+  _jl_unlock(ctx);
   return 0;
 }
 
-struct listentry *_jl_hash_get(const void *key)
+struct listentry *_jl_hash_get(struct jlctx *ctx, const void *key)
 {
   struct bucket *bkt;
+  struct listentry *entry = NULL;
   
-  if(!listhash)
-    _alloc_jelist();
-
-  bkt = listhash[_hash(key)];
-  if(bkt)
-    {
-      for(;bkt;bkt=bkt->next)
-	if(bkt->item->t.node.item == key)
-	  return bkt->item;
-    }
-  return NULL;
+  _jl_lock(ctx);
+  if(ctx->listhash)
+    for(bkt = ctx->listhash[_hash(ctx, key)];bkt;bkt=bkt->next)
+      if(bkt->item->t.node.item == key)
+	{
+	  entry = bkt->item;
+	  break;
+	}
+  _jl_unlock(ctx);
+  return entry;
 }
 
-int _jl_hash_del(const void *key)
+int _jl_hash_del(struct jlctx *ctx, const void *key)
 {
   struct bucket *bkt, *prev=NULL;
   
-  bkt = listhash[_hash(key)];
+  _jl_lock(ctx);
+  if(!ctx->listhash)
+    {
+      _jl_unlock(ctx);
+      return -1;
+    }
+
+  bkt = ctx->listhash[_hash(ctx, key)];
   if(bkt)
     {
       for(;bkt;bkt=bkt->next)
@@ -337,42 +403,131 @@ int _jl_hash_del(const void *key)
 	      if(prev)
 		prev->next = bkt->next;
 	      else
-		listhash[_hash(key)] = bkt->next;
-	      jl_dealloc(bkt);
-	      hashcount--;
+		ctx->listhash[_hash(ctx, key)] = bkt->next;
+	      ctx->hashcount--;
+	      _jl_unlock(ctx);
+	      jl_dealloc(ctx, bkt);
 	      return 0;
 	    }
 	  prev=bkt;
 	}
     }
+  _jl_unlock(ctx);
   return -1;
 }
 
 void jl_compact()
 {
-  if((1<<hashsize) > hashcount)
-    _realloc_jelist();
+  struct jlctx *ctx = _jl_ctx();
+
+  _jl_lock(ctx);
+  if(ctx->listhash && ((1<<ctx->hashsize) > ctx->hashcount))
+    _realloc_jelist(ctx);
+  _jl_unlock(ctx);
 }
 
-struct jlnode *_jl_node_new(const void *key)
+struct jlnode *_jl_node_new(struct jlctx *ctx, const void *key)
 {
   struct jlnode *node;
 
-  if(_jl_hash_get(key)) return NULL;
+  /* a pointer may be in one list only, whatever its context */
+  if(_jl_node_get(key) || (ctx != _jl_ctx() && _jl_hash_get(ctx, key)))
+    return NULL;
 
-  node = jl_malloc(sizeof(struct listentry));
+  node = jl_malloc(ctx, sizeof(struct jlnode));
   if(!node) return NULL;
-  memset(node, 0, sizeof(struct listentry));
+  memset(node, 0, sizeof(struct jlnode));
+  /* set before the node is visible to lookups from other threads */
+  node->item = (void*) key;
   
-  if(_jl_hash_store((struct listentry *) node, key))
+  if(_jl_hash_store(ctx, (struct listentry *) node, key))
     {
-      jl_dealloc(node);
+      jl_dealloc(ctx, node);
       return NULL;
     }
 
   return node;
 }
 
+struct jlctx *_jl_ctx()
+{
+  return curctx ? curctx : &defctx;
+}
+
+static void _jl_ctx_lock()
+{
+  while(__sync_lock_test_and_set(&ctxlock, 1))
+    ;
+}
+
+static void _jl_ctx_unlock()
+{
+  __sync_lock_release(&ctxlock);
+}
+
+/* node of item, looked up in the current context first and then in the
+   shared contexts, each under its own lock */
+struct jlnode *_jl_node_get(const void *item)
+{
+  struct jlctx *cur = _jl_ctx(), *ctx;
+  struct jlnode *n;
+
+  n = (struct jlnode *) _jl_hash_get(cur, item);
+  if(n) return n;
+  _jl_ctx_lock();
+  for(ctx=ctxlist;ctx && !n;ctx=ctx->next)
+    if(ctx != cur)
+      n = (struct jlnode *) _jl_hash_get(ctx, item);
+  _jl_ctx_unlock();
+  return n;
+}
+
+struct jlctx *jl_ctx_new()
+{
+  struct jlctx *ctx;
+  
+  ctx = malloc(sizeof(struct jlctx));
+  if(ctx)
+    {
+      memset(ctx, 0, sizeof(struct jlctx));
+      ctx->shared = 1;
+      _jl_ctx_lock();
+      ctx->next = ctxlist;
+      ctxlist = ctx;
+      _jl_ctx_unlock();
+    }
+  return ctx;
+}
+
+/* lists in the context must already be freed (or be discarded by an
+   external allocator) */
+void jl_ctx_free(struct jlctx *ctx)
+{
+  struct jlctx **p;
+
+  if(!ctx) return;
+  _jl_ctx_lock();
+  for(p=&ctxlist;*p;p=&(*p)->next)
+    if(*p == ctx)
+      {
+	*p = ctx->next;
+	break;
+      }
+  _jl_ctx_unlock();
+  if(ctx->listhash)
+    jl_dealloc(ctx, ctx->listhash);
+  if(ctx == curctx)
+    curctx = NULL;
+  free(ctx);
+}
+
+struct jlctx *jl_ctx_set(struct jlctx *ctx)
+{
+  struct jlctx *prev = curctx;
+  curctx = ctx;
+  return prev;
+}
+
 #ifdef TESTJELIST
 
 #include <jelio.h>
@@ -381,15 +536,16 @@ struct jlnode *_jl_node_new(const void *key)
 
 int hashstat()
 {
+  struct jlctx *ctx = _jl_ctx();
   int i;
   int empty=0;
   
-  for(i=0;i<(1<<hashsize);i++)
+  for(i=0;i<(1<<ctx->hashsize);i++)
     {
-      if(!listhash[i]) empty++;
-      // else printf("%p ", listhash[i]);
+      if(!ctx->listhash[i]) empty++;
+      // else printf("%p ", ctx->listhash[i]);
     }
-  printf("\nsize: %d bkts: %d empty: %d\n", 1<<hashsize, hashcount, empty);
+  printf("\nsize: %d bkts: %d empty: %d\n", 1<<ctx->hashsize, ctx->hashcount, empty);
 
   return 0;
 }
@@ -460,7 +616,7 @@ int main(int argc, char **argv)
 	printf("error jl_del(%d)\n", i);
       jl_compact();
     }
-  printf("hashcount: %d\n", hashcount);
+  printf("hashcount: %d\n", _jl_ctx()->hashcount);
 
   printf("** Pointer test starts **\n");
   for(i=0;i<NITEMS;i++)
@@ -511,11 +667,13 @@ gcc -g -Wall -D TESTJELIST -o jelist jelist.c
 
 int jl_del(const void *node)
 {
+  struct jlctx *ctx;
   struct jlnode *n;
   
-  n = (struct jlnode *) _jl_hash_get(node);
+  n = _jl_node_get(node);
   if(n)
     {
+      ctx = _jl_node_ctx(n);
       if(n->prev)
 	n->prev->next = n->next;
       if(n->next)
@@ -526,9 +684,10 @@ int jl_del(const void *node)
       if(n->list->last == n)
 	n->list->last = n->prev;
       n->list->len--;
-      if(_jl_hash_del(node))
+      _jl_index_inval(n->list);
+      if(_jl_hash_del(ctx, node))
 	return -1;
-      jl_dealloc(n);
+      jl_dealloc(ctx, n);
       return 0;
     }
   return -1;
@@ -549,7 +708,7 @@ void *jl_first(const void *node)
 {
   struct jlnode *n;
 
-  n = (struct jlnode *) _jl_hash_get(node);
+  n = _jl_node_get(node);
   if(n) return n->list->first->item;
   return NULL;
 }
@@ -558,7 +717,7 @@ void *jl_last(const void *node)
 {
   struct jlnode *n;
 
-  n = (struct jlnode *) _jl_hash_get(node);
+  n = _jl_node_get(node);
   if(n) return n->list->last->item;
   return NULL;
 }
@@ -604,17 +763,21 @@ void jl_foreachfn(struct jlhead *head, void(*fn)(void *item, void *data), void *
 void jl_freefn_static(struct jlhead *head, void(*fn)(void *item))
 {
   struct jlnode *n, *nn;
+  struct jlctx *ctx;
   if(head)
     {
+      ctx = _jl_head_ctx(head);
       n=head->first;
       while(n)
 	{
 	  nn=n->next;
 	  if(fn) fn(n->item);
-	  _jl_hash_del(n->item);
-	  jl_dealloc(n);
+	  _jl_hash_del(ctx, n->item);
+	  jl_dealloc(ctx, n);
 	  n=nn;
 	}
+      if(head->index)
+	jl_dealloc(ctx, head->index);
       memset(head, 0, sizeof(struct listentry));
     }
 }
@@ -622,10 +785,12 @@ void jl_freefn_static(struct jlhead *head, void(*fn)(void *item))
 /* free the whole list. call fn for each item. Also free head. */
 void *jl_freefn(struct jlhead *head, void(*fn)(void *item))
 {
+  struct jlctx *ctx;
   if(head)
     {
+      ctx = _jl_head_ctx(head);
       jl_freefn_static(head, fn);
-      jl_dealloc(head);
+      jl_dealloc(ctx, head);
     }
   return NULL;
 }
@@ -656,7 +821,7 @@ struct jlhead *jl_head(const void *node)
 {
   struct jlnode *n;
 
-  n = (struct jlnode *) _jl_hash_get(node);
+  n = _jl_node_get(node);
   if(n) return n->list;
   return NULL;
 }
@@ -739,7 +904,7 @@ unsigned int jl_len(const void *item)
 {
   struct jlnode *n;
   int count=0;
-  for(n = (struct jlnode *) _jl_hash_get(item);n;n=n->next)
+  for(n = _jl_node_get(item);n;n=n->next)
     count++;
   return count-1;
 }
@@ -756,9 +921,11 @@ unsigned int jl_len(const void *item)
 #include <string.h>
 
 
+/* the list is bound to the current context */
 int jl_new_static(struct jlhead *head)
 {
   memset(head, 0, sizeof(struct listentry));
+  head->ctx = _jl_ctx();
   return 0;
 }
 
@@ -766,11 +933,11 @@ int jl_new_static(struct jlhead *head)
 struct jlhead *jl_new()
 {
   struct jlhead *head;
-  head = jl_malloc(sizeof(struct listentry));
+  head = jl_malloc(_jl_ctx(), sizeof(struct listentry));
   if(!head) return NULL;
   if(jl_new_static(head))
     {
-      jl_dealloc(head);
+      jl_dealloc(_jl_ctx(), head);
       return NULL;
     }
   
@@ -792,7 +959,7 @@ void *jl_next(const void *node)
 {
   struct jlnode *n;
 
-  n = (struct jlnode *) _jl_hash_get(node);
+  n = _jl_node_get(node);
   if(n)
     {
       n = n->next;
@@ -818,9 +985,8 @@ int jl_prepend(struct jlhead *head, const void *node)
 
   if(!head) return -1;
 
-  n = _jl_node_new(node);
+  n = _jl_node_new(_jl_head_ctx(head), node);
   if(!n) return -1;
-  n->item = (void*) node;
   n->list = head;
   n->next = head->first;
   n->prev = NULL;
@@ -829,6 +995,7 @@ int jl_prepend(struct jlhead *head, const void *node)
 
   head->first = n;
   head->len++;
+  _jl_index_inval(head);
   return 0;
 }
 /*
@@ -853,7 +1020,16 @@ int jl_prepend_list(struct jlhead *dst, struct jlhead *src)
   if(!src->first)
     return 0;
   for(n=src->first;n;n=n->next)
-    n->list = dst;
+    {
+      /* nodes are found through the hash of the context of their list */
+      if(_jl_head_ctx(src) != _jl_head_ctx(dst))
+	{
+	  _jl_hash_del(_jl_head_ctx(src), n->item);
+	  if(_jl_hash_store(_jl_head_ctx(dst), (struct listentry*)n, n->item))
+	    return -1;
+	}
+      n->list = dst;
+    }
   if(!dst->first)
     {
       dst->first = src->first;
@@ -870,6 +1046,8 @@ int jl_prepend_list(struct jlhead *dst, struct jlhead *src)
  out:
   src->first = src->last = NULL;
   src->len = 0;
+  _jl_index_inval(src);
+  _jl_index_inval(dst);
   return 0;
 }
 /*
@@ -888,7 +1066,7 @@ void *jl_prev(const void *node)
 {
   struct jlnode *n;
 
-  n = (struct jlnode *) _jl_hash_get(node);
+  n = _jl_node_get(node);
   if(n)
     {
       n = n->prev;
@@ -911,20 +1089,21 @@ int jl_repl(const void *iteminlist, const void *newitem)
 {
   struct jlnode *n, *nn;
   
-  n = (struct jlnode *) _jl_hash_get(iteminlist);
-  nn = (struct jlnode *) _jl_hash_get(newitem);
+  n = _jl_node_get(iteminlist);
+  nn = _jl_node_get(newitem);
   
   if(n)
     {
-      _jl_hash_del(n->item);
+      _jl_hash_del(_jl_node_ctx(n), n->item);
       n->item = (void*) newitem;
+      /* the index refers to nodes so it stays valid across item swaps */
       if(nn)
 	{
-	  _jl_hash_del(nn->item);
+	  _jl_hash_del(_jl_node_ctx(nn), nn->item);
 	  nn->item = (void*) iteminlist;
 	}
-      _jl_hash_store((struct listentry*)n, newitem);
-      if(nn) _jl_hash_store((struct listentry*)nn, iteminlist);
+      _jl_hash_store(_jl_node_ctx(n), (struct listentry*)n, newitem);
+      if(nn) _jl_hash_store(_jl_node_ctx(nn), (struct listentry*)nn, iteminlist);
       return 0;
     }
   return -1;
@@ -938,12 +1117,73 @@ int jl_repl(const void *iteminlist, const void *newitem)
  *
  */
 
+#include <string.h>
 
-#define INSERTIONSORT
+#define MERGESORT
+
+#ifdef MERGESORT
+/* merge two sorted node chains. equal items are taken from a first (stable) */
+static struct jlnode *_jl_merge(struct jlnode *a, struct jlnode *b,
+				int(*fn)(const void *i1, const void *i2))
+{
+  struct jlnode head, *t = &head;
+  
+  while(a && b)
+    {
+      if(fn(a->item, b->item) <= 0)
+	{
+	  t->next = a;
+	  a = a->next;
+	}
+      else
+	{
+	  t->next = b;
+	  b = b->next;
+	}
+      t = t->next;
+    }
+  t->next = a ? a : b;
+  return head.next;
+}
+#endif
 
 /* if fn() returns i1-i2 then the list is sorted in ascending order */
 int jl_sort(struct jlhead *list, int(*fn)(const void *i1, const void *i2))
 {
+#ifdef MERGESORT
+  /* bottom-up merge sort on the next-chain. nodes are relinked, items and
+     hash entries stay untouched. runs[i] holds a sorted run of 2^i nodes. */
+  struct jlnode *runs[32], *n, *next, *prev;
+  int i;
+  
+  if(!fn) fn = list->sortfn;
+  if(fn && list->first)
+    {
+      memset(runs, 0, sizeof(runs));
+      for(n=list->first;n;n=next)
+	{
+	  next = n->next;
+	  n->next = NULL;
+	  for(i=0;(i<31) && runs[i];i++)
+	    {
+	      n = _jl_merge(runs[i], n, fn);
+	      runs[i] = NULL;
+	    }
+	  runs[i] = i==31 ? _jl_merge(runs[i], n, fn) : n;
+	}
+      for(n=NULL,i=0;i<32;i++)
+	if(runs[i])
+	  n = n ? _jl_merge(runs[i], n, fn) : runs[i];
+      
+      /* restore prev links and the list ends */
+      list->first = n;
+      for(prev=NULL;n;prev=n,n=n->next)
+	n->prev = prev;
+      list->last = prev;
+      _jl_index_inval(list);
+    }
+#endif
+
 #ifdef BUBBLESORT
   void *n, *nn;
   int f=1;
@@ -995,24 +1235,22 @@ int jl_sort(struct jlhead *list, int(*fn)(const void *i1, const void *i2))
  */
 
 #include <stdlib.h>
-
-#define insdbg 0
+#include <string.h>
 
 int jl_ins(struct jlhead *head, const void *node)
 {
   struct jlnode *n, *ln;
-  int f,l,pos,opos,i,rc,after=0;
+  unsigned int f, l, pos;
   
   if(!head) return -1;
 
-  //if(insdbg) printf("jl_ins(%p)\n", node);
-  
-  n = _jl_node_new(node);
+  n = _jl_node_new(_jl_head_ctx(head), node);
   if(!n) return -1;
-  n->item = (void*) node;
   n->list = head;
   
-  if( (!head->sortfn) || (head->len == 0))
+  /* unsorted, empty or sorting last: append */
+  if( (!head->sortfn) || (head->len == 0) ||
+      (head->sortfn(node, head->last->item) >= 0) )
     {
       n->next = NULL;
       n->prev = head->last;
@@ -1022,79 +1260,55 @@ int jl_ins(struct jlhead *head, const void *node)
   
       head->last = n;
       head->len++;
+      if(head->indexvalid && (head->len <= head->indexsize))
+	head->index[head->len-1] = n;
+      else
+	_jl_index_inval(head);
       return 0;
     }
   
-  /* perform binary sort on the list to find the right insertion position */
-
-  f = 0;
-  l = head->len - 1;
-  
-  pos = (f+l)/2;
-  ln = head->first;
-  for(i=0;i<pos;i++) ln = ln->next;
-  
-  while(1)
+  /* binary search in the positional index for the first item sorting
+     after node. the last item is known to sort after node. */
+  if(_jl_index_build(head))
     {
-      rc = head->sortfn(node, ln->item);
-      /*if(insdbg) printf("%d = fn(%p,%p) f=%d l=%d pos=%d\n",
-			rc, node, ln->item,
-			f,l,pos);*/
-      if(rc == 0)
-	{
-	  after = 1;
-	  break;
-	}
-      if(rc > 0)
+      for(pos=0,ln=head->first;head->sortfn(node, ln->item) >= 0;pos++)
+	ln = ln->next;
+    }
+  else
+    {
+      f = 0;
+      l = head->len - 1;
+      while(f < l)
 	{
-	  if( (l-f) == 0)
-	    {
-	      after = 1;
- 	      break;	      
-	    }
-	  opos = pos;
-	  if(f == pos) pos++;
-	  f = pos;
 	  pos = (f+l)/2;
-	  //if(insdbg) printf("advance %d\n", pos - opos);
-	  for(i=0;i<(pos-opos);i++) ln = ln->next;
-	  continue;
+	  if(head->sortfn(node, head->index[pos]->item) >= 0)
+	    f = pos+1;
+	  else
+	    l = pos;
 	}
-
-      if( (l-f) == 0)
-	{
-	  break;	      
-	}
-      opos = pos;
-      l = pos;
-      pos = (f+l)/2;
-      //if(insdbg) printf("backup %d\n", opos - pos);
-      for(i=0;i<(opos-pos);i++) ln = ln->prev;
+      pos = f;
+      ln = head->index[pos];
     }
 
-  if(after)
-    {
-      n->next = ln->next;
-      n->prev = ln;
-      
-      if(ln->next)
-	ln->next->prev = n;
-      else
-	n->list->last = n;
-      ln->next = n;
-    }
+  n->next = ln;
+  n->prev = ln->prev;
+  
+  if(ln->prev)
+    ln->prev->next = n;
   else
+    n->list->first = n;
+  ln->prev = n;
+  head->len++;
+
+  /* keep the index valid by shifting it instead of rebuilding */
+  if(head->indexvalid && (head->len <= head->indexsize))
     {
-      n->next = ln;
-      n->prev = ln->prev;
-      
-      if(ln->prev)
-	ln->prev->next = n;
-      else
-	n->list->first = n;
-      ln->prev = n;
+      memmove(head->index+pos+1, head->index+pos,
+	      sizeof(struct jlnode *)*(head->len-1-pos));
+      head->index[pos] = n;
     }
-  head->len++;
+  else
+    _jl_index_inval(head);
   return 0;
 }
 /*
@@ -1109,12 +1323,41 @@ int jl_ins(struct jlhead *head, const void *node)
 #include <stdlib.h>
 
 
+/* (re)build the positional index of the list */
+int _jl_index_build(struct jlhead *head)
+{
+  struct jlnode *n, **index;
+  unsigned int i, size;
+  
+  if(head->indexvalid) return 0;
+  
+  if(head->indexsize < head->len)
+    {
+      for(size=head->indexsize?head->indexsize:16;size<head->len;size<<=1);
+      index = jl_malloc(_jl_head_ctx(head), sizeof(struct jlnode *)*size);
+      if(!index) return -1;
+      if(head->index)
+	jl_dealloc(_jl_head_ctx(head), head->index);
+      head->index = index;
+      head->indexsize = size;
+    }
+  
+  for(i=0,n=head->first;n;n=n->next)
+    head->index[i++] = n;
+  head->indexvalid = 1;
+  return 0;
+}
+
 void *jl_at(const struct jlhead *head, int pos)
 {
   struct jlnode *n;
   
   if(head && (pos < head->len) && (pos >= 0))
     {
+      /* the index is only a cache, building it does not modify the list */
+      if(!_jl_index_build((struct jlhead *) head))
+	return head->index[pos]->item;
+
       for(n=head->first;n && pos;n=n->next) pos--;
       if(n && (pos == 0))
 	return n->item;
@@ -1132,32 +1375,146 @@ void *jl_at(const struct jlhead *head, int pos)
 
 #include <stdlib.h>
 
-static void*(*allocfn)(unsigned int size);
-static void*(*deallocfn)(void *ptr);
-
+/* hooks are set for the current context */
 void jl_allocator(void*(*fn)(unsigned int size))
 {
-  allocfn = fn;
+  _jl_ctx()->allocfn = fn;
 }
 
 void jl_deallocator(void*(*fn)(void *ptr))
 {
-  deallocfn = fn;
+  _jl_ctx()->deallocfn = fn;
+}
+
+void jl_allocator_data(void*(*fn)(void *data, unsigned int size), void *data)
+{
+  struct jlctx *ctx = _jl_ctx();
+
+  ctx->dataallocfn = fn;
+  ctx->data = data;
 }
 
-void *jl_malloc(unsigned int size)
+void *jl_malloc(struct jlctx *ctx, unsigned int size)
 {
-  if(allocfn)
-    return allocfn(size);
+  if(ctx->dataallocfn)
+    return ctx->dataallocfn(ctx->data, size);
+  if(ctx->allocfn)
+    return ctx->allocfn(size);
   return malloc(size);
 }
 
-void jl_dealloc(void *ptr)
+void jl_dealloc(struct jlctx *ctx, void *ptr)
 {
-  if(deallocfn)
+  if(ctx->deallocfn)
     {
-      deallocfn(ptr);
+      ctx->deallocfn(ptr);
       return;
     }
   free(ptr);
 }
+#ifdef BENCHJELIST
+
+#include <stdio.h>
+#include <time.h>
+
+#define NQUEUES 10000
+
+struct benchq {
+  int n;
+};
+
+static int benchqcmp(const void *i1, const void *i2)
+{
+  const struct benchq *q1=i1, *q2=i2;
+  return q1->n - q2->n;
+}
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int check(struct jlhead *h, const char *what)
+{
+  struct benchq *q;
+  int i=0;
+
+  jl_foreach(h, q)
+    if(q->n != i++)
+      {
+	printf("ERROR: %s: item %d out of order\n", what, i-1);
+	return -1;
+      }
+  if(i != NQUEUES)
+    printf("ERROR: %s: %d items != %d\n", what, i, NQUEUES);
+  return 0;
+}
+
+/* insert NQUEUES queues in random order into a sorted list */
+int main(int argc, char **argv)
+{
+  static struct benchq q[NQUEUES], *p[NQUEUES], *t;
+  struct jlhead *h, *d;
+  struct jlctx *ctx;
+  double start;
+  int i, j;
+
+  srandom(argc > 1 ? atoi(argv[1]) : 1);
+  for(i=0;i<NQUEUES;i++)
+    {
+      q[i].n = i;
+      p[i] = &q[i];
+    }
+  for(i=NQUEUES-1;i>0;i--)
+    {
+      j = random() % (i+1);
+      t = p[i]; p[i] = p[j]; p[j] = t;
+    }
+
+  h = jl_new();
+  jl_sort(h, benchqcmp);
+  start = now();
+  for(i=0;i<NQUEUES;i++)
+    jl_ins(h, p[i]);
+  printf("jl_ins: %d random queues in %.3f ms\n", NQUEUES, (now()-start)*1000);
+  check(h, "jl_ins");
+  jl_free(h);
+
+  h = jl_new();
+  for(i=0;i<NQUEUES;i++)
+    jl_append(h, p[i]);
+  start = now();
+  jl_sort(h, benchqcmp);
+  printf("jl_sort: %d random queues in %.3f ms\n", NQUEUES, (now()-start)*1000);
+  check(h, "jl_sort");
+  jl_free(h);
+
+  /* a list made in another context is walked from the default one */
+  ctx = jl_ctx_new();
+  jl_ctx_set(ctx);
+  h = jl_new();
+  for(i=0;i<NQUEUES;i++)
+    jl_append(h, &q[i]);
+  jl_ctx_set(NULL);
+  check(h, "other context");
+  jl_del(&q[0]);
+  if(jl_len(&q[1]) != NQUEUES-2)
+    printf("ERROR: other context: jl_del\n");
+  /* and its items can not be added to a list of the default context */
+  d = jl_new();
+  if(!jl_append(d, &q[1]))
+    printf("ERROR: other context: duplicate\n");
+  jl_free(d);
+  jl_free(h);
+  jl_ctx_free(ctx);
+
+  return 0;
+}
+
+#endif
+
+/*
+gcc -O2 -Wall -D BENCHJELIST -o jelist-bench jelist.c
+*/
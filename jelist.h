@@ -9,8 +9,25 @@
 
    Hashtable will only be shrunk when calling jl_compact().
    Hashtable will automatically expand when needed.
+
+   jl_at() uses a positional index that is rebuilt on demand after
+   the list has been modified. Repeated positional lookups on an
+   unmodified list are O(1).
+
+   All list state lives in a context (struct jlctx). Each thread has a
+   default context, so lists may be used from several threads as long
+   as a single list is not shared between threads.
+   A list is bound to the context that is current when it is created.
+   Functions that only take an item look it up in the current context,
+   then in the contexts made by jl_ctx_new(), and work on the context
+   of its list. Items of lists in a thread default context are only
+   found from that thread.
+   The hash of a context made by jl_ctx_new() is locked on each access,
+   so such a context may be used from several threads at once.
  */
 
+struct jlctx;
+
 struct jlnode {
   struct jlnode *next;
   struct jlnode *prev;
@@ -21,6 +38,10 @@ struct jlhead {
   struct jlnode *first, *last;
   unsigned int len;
   int(*sortfn)(const void *i1, const void *i2);
+  struct jlctx *ctx;
+  struct jlnode **index; /* positional index, valid if indexvalid */
+  unsigned int indexsize;
+  int indexvalid;
 };
 struct jliter {
   struct jlnode *next;
@@ -37,6 +58,13 @@ void jl_freefn_static(struct jlhead *head, void(*fn)(void *item));
 /* perform compacting of hashtable */
 void jl_compact();
 
+struct jlctx *jl_ctx_new();
+/* all lists in ctx must be freed before the context */
+void jl_ctx_free(struct jlctx *ctx);
+/* select context for the calling thread. NULL selects the thread default.
+   Returns the previous context. */
+struct jlctx *jl_ctx_set(struct jlctx *ctx);
+
 void *jl_next(const void *item);
 void *jl_prev(const void *item);
 void *jl_first(const void *item);
@@ -70,9 +98,12 @@ void *jl_iter(struct jliter *buf);
 /* if fn() returns i1-i2 then the list is sorted in ascending order */
 int jl_sort(struct jlhead *list, int(*fn)(const void *i1, const void *i2));
 
-/* Provide functions for memory management */
+/* Provide functions for memory management of the current context */
 void jl_allocator(void*(*fn)(unsigned int size));
 void jl_deallocator(void*(*fn)(void *ptr));
+/* as jl_allocator(), fn is also passed data, e.g. the owner of the
+   context. Takes precedence over jl_allocator(). */
+void jl_allocator_data(void*(*fn)(void *data, unsigned int size), void *data);
 
 #endif
 
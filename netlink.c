@@ -0,0 +1,347 @@
+/*
+ * File: netlink.c
+ * Implements: netdev queue lookups and link change events over netlink
+ *
+ * Copyright license: According to GPL, see file COPYING in this directory.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include <linux/rtnetlink.h>
+
+#include "netlink.h"
+
+#ifndef SOL_NETLINK
+#define SOL_NETLINK 270
+#endif
+
+/* from linux/netdev.h and linux/ethtool_netlink.h, which older kernel
+   headers lack */
+#define NETDEV_CMD_QUEUE_GET 10
+#define NETDEV_A_QUEUE_ID 1
+#define NETDEV_A_QUEUE_IFINDEX 2
+#define NETDEV_A_QUEUE_TYPE 3
+#define NETDEV_A_QUEUE_NAPI_ID 4
+#define NETDEV_QUEUE_TYPE_RX 0
+#define ETHTOOL_MSG_CHANNELS_NTF 19
+#define ETHTOOL_A_CHANNELS_HEADER 1
+#define ETHTOOL_A_HEADER_DEV_INDEX 1
+
+#define NLBUF 32768
+
+#define NLA_DATA(a) ((const char *)(a) + NLA_HDRLEN)
+#define NLA_LEN(a) ((a)->nla_len - NLA_HDRLEN)
+#define NLA_U32(a) (*(const unsigned int *)NLA_DATA(a))
+
+#define nla_foreach(a, p, len, rem)					\
+	for(a = (const struct nlattr *)(p), rem = (len);		\
+	    rem >= NLA_HDRLEN && a->nla_len >= NLA_HDRLEN && a->nla_len <= rem; \
+	    rem -= NLA_ALIGN(a->nla_len),				\
+		    a = (const struct nlattr *)((const char *)a + NLA_ALIGN(a->nla_len)))
+
+/* genetlink request with room for a few attributes */
+struct nlreq {
+	struct nlmsghdr n;
+	struct genlmsghdr g;
+	char attrs[64];
+};
+
+struct family {
+	int id;
+	const char *grp; /* multicast group to look up, NULL for none */
+	int grpid;
+};
+
+struct queues {
+	int ifindex;
+	int *napi, n;
+	int count;
+};
+
+/* attributes in tb[1..max], NULL if absent */
+static void nl_attrs(const void *p, int len, const struct nlattr **tb, int max)
+{
+	const struct nlattr *a;
+	int rem, type;
+
+	memset(tb, 0, sizeof(*tb) * (max+1));
+	nla_foreach(a, p, len, rem) {
+		type = a->nla_type & NLA_TYPE_MASK;
+		if(type <= max)
+			tb[type] = a;
+	}
+}
+
+/* attributes following the genetlink header of n */
+static void genl_attrs(const struct nlmsghdr *n, const struct nlattr **tb, int max)
+{
+	nl_attrs((const char *)NLMSG_DATA(n) + GENL_HDRLEN,
+		 n->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN), tb, max);
+}
+
+static void nl_put(struct nlreq *r, int type, const void *data, int len)
+{
+	struct nlattr *a;
+
+	a = (struct nlattr *)((char *)&r->n + NLMSG_ALIGN(r->n.nlmsg_len));
+	a->nla_type = type;
+	a->nla_len = NLA_HDRLEN + len;
+	memcpy((char *)a + NLA_HDRLEN, data, len);
+	r->n.nlmsg_len = NLMSG_ALIGN(r->n.nlmsg_len) + NLA_ALIGN(a->nla_len);
+}
+
+static void genl_req(struct nlreq *r, int family, int cmd, int flags)
+{
+	memset(r, 0, sizeof(*r));
+	r->n.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+	r->n.nlmsg_type = family;
+	r->n.nlmsg_flags = NLM_F_REQUEST | flags;
+	r->g.cmd = cmd;
+	r->g.version = 1;
+}
+
+static int nl_open(int proto, unsigned int groups)
+{
+	struct sockaddr_nl sa;
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_RAW, proto);
+	if(fd == -1)
+		return -1;
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	sa.nl_groups = groups;
+	if(bind(fd, (struct sockaddr *)&sa, sizeof(sa))) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* send r and pass each reply to fn until the dump is done or the
+   request acked. Returns -1 if the kernel reports an error */
+static int nl_talk(int fd, struct nlreq *r,
+		   void (*fn)(const struct nlmsghdr *n, void *data), void *data)
+{
+	static unsigned int seq;
+	static char buf[NLBUF];
+	const struct nlmsghdr *n;
+	int len;
+
+	r->n.nlmsg_seq = ++seq;
+	if(send(fd, r, r->n.nlmsg_len, 0) != (ssize_t)r->n.nlmsg_len)
+		return -1;
+	while(1) {
+		len = recv(fd, buf, sizeof(buf), 0);
+		if(len <= 0)
+			return -1;
+		for(n = (struct nlmsghdr *)buf; NLMSG_OK(n, len);
+		    n = NLMSG_NEXT(n, len)) {
+			if(n->nlmsg_seq != r->n.nlmsg_seq)
+				continue;
+			if(n->nlmsg_type == NLMSG_DONE)
+				return 0;
+			if(n->nlmsg_type == NLMSG_ERROR)
+				return ((const struct nlmsgerr *)NLMSG_DATA(n))->error ? -1 : 0;
+			fn(n, data);
+		}
+	}
+}
+
+static void family_reply(const struct nlmsghdr *n, void *data)
+{
+	struct family *f = data;
+	const struct nlattr *tb[CTRL_ATTR_MAX+1], *gt[CTRL_ATTR_MCAST_GRP_MAX+1];
+	const struct nlattr *g;
+	int rem;
+
+	genl_attrs(n, tb, CTRL_ATTR_MAX);
+	if(tb[CTRL_ATTR_FAMILY_ID])
+		f->id = *(const unsigned short *)NLA_DATA(tb[CTRL_ATTR_FAMILY_ID]);
+	if(!f->grp || !tb[CTRL_ATTR_MCAST_GROUPS])
+		return;
+	nla_foreach(g, NLA_DATA(tb[CTRL_ATTR_MCAST_GROUPS]),
+		    NLA_LEN(tb[CTRL_ATTR_MCAST_GROUPS]), rem) {
+		nl_attrs(NLA_DATA(g), NLA_LEN(g), gt, CTRL_ATTR_MCAST_GRP_MAX);
+		if(gt[CTRL_ATTR_MCAST_GRP_NAME] && gt[CTRL_ATTR_MCAST_GRP_ID] &&
+		   !strcmp(NLA_DATA(gt[CTRL_ATTR_MCAST_GRP_NAME]), f->grp))
+			f->grpid = NLA_U32(gt[CTRL_ATTR_MCAST_GRP_ID]);
+	}
+}
+
+/* genetlink family id of name, -1 if the kernel does not have it.
+   *grpid is set to its multicast group grp, -1 if none */
+static int genl_family(int fd, const char *name, const char *grp, int *grpid)
+{
+	struct nlreq r;
+	struct family f;
+
+	f.id = -1;
+	f.grp = grp;
+	f.grpid = -1;
+	genl_req(&r, GENL_ID_CTRL, CTRL_CMD_GETFAMILY, NLM_F_ACK);
+	nl_put(&r, CTRL_ATTR_FAMILY_NAME, name, strlen(name)+1);
+	if(nl_talk(fd, &r, family_reply, &f))
+		return -1;
+	if(grpid)
+		*grpid = f.grpid;
+	return f.id;
+}
+
+static void queue_reply(const struct nlmsghdr *n, void *data)
+{
+	struct queues *qs = data;
+	const struct nlattr *tb[NETDEV_A_QUEUE_NAPI_ID+1];
+	unsigned int id;
+
+	genl_attrs(n, tb, NETDEV_A_QUEUE_NAPI_ID);
+	if(!tb[NETDEV_A_QUEUE_ID] || !tb[NETDEV_A_QUEUE_IFINDEX] ||
+	   !tb[NETDEV_A_QUEUE_TYPE])
+		return;
+	if(NLA_U32(tb[NETDEV_A_QUEUE_IFINDEX]) != (unsigned int)qs->ifindex ||
+	   NLA_U32(tb[NETDEV_A_QUEUE_TYPE]) != NETDEV_QUEUE_TYPE_RX)
+		return;
+	id = NLA_U32(tb[NETDEV_A_QUEUE_ID]);
+	if(id >= (unsigned int)qs->n)
+		return;
+	if(tb[NETDEV_A_QUEUE_NAPI_ID])
+		qs->napi[id] = NLA_U32(tb[NETDEV_A_QUEUE_NAPI_ID]);
+	if((int)id >= qs->count)
+		qs->count = id + 1;
+}
+
+int nl_queue_napi(int ifindex, int *napi, int n)
+{
+	struct nlreq r;
+	struct queues qs;
+	unsigned int idx = ifindex;
+	int fd, family, rc = -1;
+
+	fd = nl_open(NETLINK_GENERIC, 0);
+	if(fd == -1)
+		return -1;
+	family = genl_family(fd, "netdev", NULL, NULL);
+	if(family >= 0) {
+		qs.ifindex = ifindex;
+		qs.napi = napi;
+		qs.n = n;
+		qs.count = 0;
+		memset(napi, 0, sizeof(int) * n);
+		genl_req(&r, family, NETDEV_CMD_QUEUE_GET, NLM_F_DUMP);
+		nl_put(&r, NETDEV_A_QUEUE_IFINDEX, &idx, sizeof(idx));
+		if(!nl_talk(fd, &r, queue_reply, &qs))
+			rc = qs.count;
+	}
+	close(fd);
+	return rc;
+}
+
+int nl_watch_open(struct nlwatch *w)
+{
+	int grp = -1;
+
+	w->ethtool = -1;
+	w->rt = nl_open(NETLINK_ROUTE, RTMGRP_LINK);
+	if(w->rt == -1)
+		return -1;
+	/* channel changes only come from ethtool. without it a device
+	   reconfigured while it stays up goes unnoticed */
+	w->gen = nl_open(NETLINK_GENERIC, 0);
+	if(w->gen != -1) {
+		w->ethtool = genl_family(w->gen, "ethtool", "monitor", &grp);
+		if(w->ethtool < 0 || grp < 0 ||
+		   setsockopt(w->gen, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP,
+			      &grp, sizeof(grp))) {
+			close(w->gen);
+			w->gen = -1;
+		}
+	}
+	return 0;
+}
+
+void nl_watch_close(struct nlwatch *w)
+{
+	if(w->rt != -1)
+		close(w->rt);
+	if(w->gen != -1)
+		close(w->gen);
+	w->rt = w->gen = -1;
+}
+
+/* ifindex of a device that came up or changed channels, 0 if n is
+   some other event */
+static int nl_event(const struct nlwatch *w, const struct nlmsghdr *n)
+{
+	const struct ifinfomsg *ifi;
+	const struct genlmsghdr *g;
+	const struct nlattr *tb[ETHTOOL_A_CHANNELS_HEADER+1];
+	const struct nlattr *ht[ETHTOOL_A_HEADER_DEV_INDEX+1];
+
+	if(n->nlmsg_type == RTM_NEWLINK) {
+		ifi = NLMSG_DATA(n);
+		if((ifi->ifi_flags & IFF_UP) && (ifi->ifi_change & IFF_UP))
+			return ifi->ifi_index;
+		return 0;
+	}
+	if(n->nlmsg_type != w->ethtool)
+		return 0;
+	g = NLMSG_DATA(n);
+	if(g->cmd != ETHTOOL_MSG_CHANNELS_NTF)
+		return 0;
+	genl_attrs(n, tb, ETHTOOL_A_CHANNELS_HEADER);
+	if(!tb[ETHTOOL_A_CHANNELS_HEADER])
+		return 0;
+	nl_attrs(NLA_DATA(tb[ETHTOOL_A_CHANNELS_HEADER]),
+		 NLA_LEN(tb[ETHTOOL_A_CHANNELS_HEADER]), ht,
+		 ETHTOOL_A_HEADER_DEV_INDEX);
+	return ht[ETHTOOL_A_HEADER_DEV_INDEX] ?
+		(int)NLA_U32(ht[ETHTOOL_A_HEADER_DEV_INDEX]) : 0;
+}
+
+int nl_watch_next(struct nlwatch *w, int timeout, int (*wanted)(int ifindex))
+{
+	static char buf[NLBUF];
+	struct pollfd pfd[2];
+	const struct nlmsghdr *n;
+	int i, len, ifindex, found;
+
+	pfd[0].fd = w->rt;
+	pfd[1].fd = w->gen;
+	pfd[0].events = pfd[1].events = POLLIN;
+	while(1) {
+		i = poll(pfd, w->gen == -1 ? 1 : 2, timeout);
+		if(i < 0)
+			return -1;
+		if(i == 0)
+			return 0;
+		found = 0;
+		for(i=0;i<2;i++) {
+			if(pfd[i].fd == -1 || !(pfd[i].revents & POLLIN))
+				continue;
+			len = recv(pfd[i].fd, buf, sizeof(buf), 0);
+			/* the socket overran, any device may have changed */
+			if(len < 0 && errno == ENOBUFS) {
+				found = 1;
+				continue;
+			}
+			if(len <= 0)
+				return -1;
+			for(n = (struct nlmsghdr *)buf; NLMSG_OK(n, len);
+			    n = NLMSG_NEXT(n, len)) {
+				ifindex = nl_event(w, n);
+				if(ifindex > 0 && wanted(ifindex))
+					found = 1;
+			}
+		}
+		if(found)
+			return found;
+	}
+}
@@ -0,0 +1,38 @@
+/*
+ * File: netlink.h
+ * Implements: netdev queue lookups and link change events over netlink
+ *
+ * Copyright license: According to GPL, see file COPYING in this directory.
+ *
+ */
+
+#ifndef NETLINK_H
+#define NETLINK_H
+
+/*
+ * napi id of each rx queue of ifindex, from the netdev family
+ * (queue-get). napi[i] is set for rx-i, 0 if it has no NAPI instance.
+ * Returns the number of queues reported (at most n), -1 if the kernel
+ * does not answer queue-get.
+ */
+int nl_queue_napi(int ifindex, int *napi, int n);
+
+/* sockets for link (rtnetlink) and channel (ethtool monitor) events */
+struct nlwatch {
+	int rt, gen;
+	int ethtool; /* ethtool family id, -1 if unknown */
+};
+
+/* returns 0 on success, -1 if link events can not be watched */
+int nl_watch_open(struct nlwatch *w);
+void nl_watch_close(struct nlwatch *w);
+
+/*
+ * Wait up to timeout ms (-1 for ever) for a device to come up or change
+ * its channels. Devices for which wanted() returns 0 are skipped.
+ * Returns 1 for such a change, or when events were lost, 0 on timeout
+ * and -1 on error.
+ */
+int nl_watch_next(struct nlwatch *w, int timeout, int (*wanted)(int ifindex));
+
+#endif